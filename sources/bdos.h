@@ -21,6 +21,7 @@
 // #include <dirent.h>
 // #include <sys/stat.h>
 #include <cstring>
+#include <algorithm>
 // #include <iostream>
 // #include <iomanip>
 
@@ -28,8 +29,12 @@
 #error "Need C++17 compiler for using <filesystem>"
 #endif
 #include <filesystem>
+#include <fstream>
 
-// #define LOG 1
+#include "filehandle.h"
+#include "console.h"
+#include "device.h"
+#include "log.h"
 
 /**
  * CP/M File Control Block
@@ -75,9 +80,32 @@ struct __attribute__ ((packed)) FCB_t {
 template <unsigned MEMORY_SIZE, uint16_t BDOS_ADDR>
 class BDos {
 public:
+/**
+ * @param aConsole Console shared with the BIOS.
+ * @param aDevices LIST, PUNCH & READER devices shared with the BIOS.
+ */
+	BDos(Console& aConsole, Devices& aDevices) :
+		console(aConsole),
+		devices(aDevices) {
+	}
+
+	~BDos() {
+		releaseHandles();
+	}
+
+/**
+ * Initialize page 0 & BDOS signature. Called on each warm boot: the files
+ * left opened by the previous program are closed.
+ */
 	void init(uint8_t *const memory) {
-		memory[0x0003] = 0;				// Default drive: 0=A
-		memory[0x0004] = 0xD3;			// Default IOBYTE: 0 ou D3 ???
+		releaseHandles();
+		Devices::flush();
+
+		if (cold) {						// kept by the warm boots
+			memory[IOBYTE] = Devices::IOBYTE;
+			cold = false;
+		}
+		memory[USER_DRIVE] = 0;			// USER: 0, DRIVE: 0 (A)
 		
 	// WARM BOOT (BDOS entry bdose)
 		memory[0x0005] = 0xC3;						// JUMP
@@ -93,6 +121,64 @@ public:
 		memory[BDOS_ADDR + 5] = 0x00;
 	}
 	
+/**
+ * Check if a function can run without waiting for the console input, so that
+ * the machine is suspended instead. The line read by function 10 is edited
+ * meanwhile, with the characters already typed.
+ * @return true if the function won't wait.
+ */
+	bool ready(const ZZ80State& state, const uint8_t memory[]) {
+		switch (state.Z_Z80_STATE_MEMBER_C) {
+			case 0x01 : return console.ready();
+			case 0x03 : return !Devices::readsConsole(memory[IOBYTE]) || console.ready();
+			case 0x0A : return console.editLine(memory[state.Z_Z80_STATE_MEMBER_DE]);
+			default : return true;
+		}
+	}
+
+/**
+ * @return the name of a BDOS function (e.g. "F_READ"), or NULL if unknown.
+ */
+	static const char* name(const uint8_t aFunction) {
+		static const char* const NAMES[] = {
+			"P_TERMCPM", "C_READ", "C_WRITE", "A_READ", "A_WRITE", "L_WRITE", "C_RAWIO", "GET_IOBYTE",
+			"SET_IOBYTE", "C_WRITESTR", "C_READSTR", "C_STAT", "S_BDOSVER", "DRV_ALLRESET", "DRV_SET", "F_OPEN",
+			"F_CLOSE", "F_SFIRST", "F_SNEXT", "F_DELETE", "F_READ", "F_WRITE", "F_MAKE", "F_RENAME",
+			"DRV_LOGINVEC", "DRV_GET", "F_DMAOFF", "DRV_ALLOCVEC", "DRV_SETRO", "DRV_ROVEC", "F_ATTRIB", "DRV_DPB",
+			"F_USERNUM", "F_READRAND", "F_WRITERAND", "F_SIZE", "F_RANDREC", "DRV_RESET", NULL, NULL,
+			"F_WRITEZF", NULL, "F_LOCK", "F_UNLOCK"
+		};
+		return (aFunction < sizeof(NAMES) / sizeof(NAMES[0])) ? NAMES[aFunction] : NULL;
+	}
+
+/**
+ * @return the bytes moved by a BDOS function: characters of the console &
+ *         devices, records read or written.
+ * @param aDE DE register before the function.
+ */
+	static unsigned transferred(const uint8_t aFunction, const uint16_t aDE, const ZZ80State& state, const uint8_t memory[]) {
+		constexpr size_t SIZE = MEMORY_SIZE * 1024;
+		switch (aFunction) {
+			case 0x01 : case 0x02 : case 0x03 : case 0x04 : case 0x05 : return 1;
+			case 0x06 : return ((aDE & 0xFF) != 0xFF) || state.Z_Z80_STATE_MEMBER_A;
+			case 0x09 : {
+				if (aDE >= SIZE) return 0;
+				const auto end = static_cast<const uint8_t*>(memchr(memory + aDE, '$', SIZE - aDE));
+				return end ? end - memory - aDE : SIZE - aDE;
+			}
+			case 0x0A : return (aDE + 1U < SIZE) ? memory[aDE + 1] : 0;
+			case 0x14 : case 0x15 : case 0x21 : case 0x22 : case 0x28 : return state.Z_Z80_STATE_MEMBER_A ? 0 : 128;
+			default : return 0;
+		}
+	}
+
+/**
+ * @return the number of files opened by the program.
+ */
+	unsigned files() const {
+		return std::count_if(fileHandle, fileHandle + MAX_HANDLES, [](const FileHandle* h) { return h != NULL; });
+	}
+
 /**
  * BDOS functions.
  * C register contains the function value.
@@ -103,7 +189,12 @@ public:
 		switch (state.Z_Z80_STATE_MEMBER_C) {
 			case 0x01 : consoleInput(state); break;
 			case 0x02 : consoleOutput(state); break;
+			case 0x03 : readerInput(state, memory); break;
+			case 0x04 : punchOutput(state, memory); break;
+			case 0x05 : listOutput(state, memory); break;
 			case 0x06 : directConsoleIO(state); break;
+			case 0x07 : getIOByte(state, memory); break;
+			case 0x08 : setIOByte(state, memory); break;
 			case 0x09 : printString(state, memory); break;
 			case 0x0A : readConsoleBuffer(state, memory); break;
 			case 0x0B : getConsoleStatus(state); break;
@@ -123,6 +214,13 @@ public:
 			case 0x1A : setDMAAddress(state); break;
 			case 0x1D : getROVector(state); break;
 			case 0x20 : setGetUserCode(state, memory); break;
+			case 0x21 : readRandom(state, memory); break;
+			case 0x22 : writeRandom(state, memory); break;
+			case 0x23 : computeFileSize(state, memory); break;
+			case 0x24 : setRandomRecord(state, memory); break;
+			case 0x28 : writeRandomWithZeroFill(state, memory); break;
+			case 0x2A : lockRecord(state, memory); break;
+			case 0x2B : unlockRecord(state, memory); break;
 			default:
 				std::cerr << "Register C: " << std::hex << std::setw(2) << std::setfill('0') << unsigned(state.Z_Z80_STATE_MEMBER_C) << "h";
 				std::cerr << ": Unknown BDOS function!" << std::endl;
@@ -148,7 +246,8 @@ protected:
  * Wait for a character from the keyboard; then echo it to the screen and return it.
  */
 	void consoleInput(ZZ80State& state) {
-		const auto c = std::cin.get();
+		const auto c = console.get();
+		if (c >= ' ') console.put(c);	// echo
 		returnCode(state, c);
 	}
 
@@ -159,19 +258,19 @@ protected:
  * Send the character in E to the screen. Tabs are expanded to spaces. Output can be paused with ^S and restarted with ^Q (or any key under versions prior to CP/M 3). While the output is paused, the program can be terminated with ^C.
  */
 	void consoleOutput(ZZ80State& state) {
- #ifdef LOG
-		std::clog << "Write console ASCII " << unsigned(state.Z_Z80_STATE_MEMBER_E) << " (";
-		switch(state.Z_Z80_STATE_MEMBER_E) {
-			case 0x00 : std::clog << "NUL"; break;
-			case 0x0a : std::clog << "LF"; break;
-			case 0x0d : std::clog << "CR"; break;
-			default:
-				std::clog << char(state.Z_Z80_STATE_MEMBER_E);
-				break;
+		if (Log::enabled()) {
+			std::clog << "Write console ASCII " << unsigned(state.Z_Z80_STATE_MEMBER_E) << " (";
+			switch(state.Z_Z80_STATE_MEMBER_E) {
+				case 0x00 : std::clog << "NUL"; break;
+				case 0x0a : std::clog << "LF"; break;
+				case 0x0d : std::clog << "CR"; break;
+				default:
+					std::clog << char(state.Z_Z80_STATE_MEMBER_E);
+					break;
+			}
+			std::clog << ")" <<  std::endl;
 		}
-		std::clog << ")" <<  std::endl;
-#endif
-		if (state.Z_Z80_STATE_MEMBER_E) std::cout << state.Z_Z80_STATE_MEMBER_E;
+		if (state.Z_Z80_STATE_MEMBER_E) console.put(state.Z_Z80_STATE_MEMBER_E);
 		returnCode(state, 0);
 	}		
 	
@@ -181,7 +280,9 @@ protected:
  * Entered with C=3. Returns A=L=ASCII character
  * Note that this call can hang if the auxiliary input never sends data.
  */
-	void readerInput();
+	void readerInput(ZZ80State& state, const uint8_t memory[]) {
+		returnCode(state, devices.reader(memory[IOBYTE]));
+	}
 	
 /**
  * BDOS function 4 (A_WRITE) - Auxiliary (Punch) output
@@ -189,7 +290,10 @@ protected:
  * Entered with C=4, E=ASCII character.
  * If the device is permanently not ready, this call can hang.
  */
-	void punchOutput();
+	void punchOutput(ZZ80State& state, const uint8_t memory[]) {
+		devices.punch(memory[IOBYTE], state.Z_Z80_STATE_MEMBER_E);
+		returnCode(state, 0);
+	}
 	
 /**
  * BDOS function 5 (L_WRITE) - Printer output
@@ -197,7 +301,10 @@ protected:
  * Entered with C=2, E=ASCII character.
  * If the printer is permanently offline or busy, this call can hang.
  */
-	void listOutput();
+	void listOutput(ZZ80State& state, const uint8_t memory[]) {
+		devices.list(memory[IOBYTE], state.Z_Z80_STATE_MEMBER_E);
+		returnCode(state, 0);
+	}
 	
 /**
  * BDOS function 6 (C_RAWIO) - Direct console I/O
@@ -216,10 +323,10 @@ protected:
 	void directConsoleIO(ZZ80State& state) {
 		if (state.Z_Z80_STATE_MEMBER_E == 0xFF) {
 			char c;
-			const auto n = std::cin.readsome(&c, 1);
+			const auto n = console.poll(c);
 			returnCode(state, n ? c : 0x00);
 		} else {
-			std::cout << char(state.Z_Z80_STATE_MEMBER_E);
+			console.put(state.Z_Z80_STATE_MEMBER_E);
 			returnCode(state, 0x00);	// ok
 		}
 	}
@@ -230,7 +337,9 @@ protected:
  * Entered with C=7. Returns I/O byte.
  * Here's a description of how the IOBYTE works. @see https://seasip.info/Cpm/iobyte.html
  */
-	void getIOByte();
+	void getIOByte(ZZ80State& state, const uint8_t memory[]) {
+		returnCode(state, memory[IOBYTE]);
+	}
 	
 /**
  * BDOS function 8 - Set I/O byte
@@ -238,7 +347,10 @@ protected:
  * Entered with C=8, E=I/O byte.
  * Here's a description of how the IOBYTE works.
  */
-	void setIOByte();
+	void setIOByte(ZZ80State& state, uint8_t memory[]) {
+		memory[IOBYTE] = state.Z_Z80_STATE_MEMBER_E;
+		returnCode(state, 0);
+	}
 	
 /**
  * BDOS function 9 (C_WRITESTR) - Output string
@@ -249,12 +361,25 @@ protected:
  */
 	void printString(ZZ80State& state, const uint8_t memory[]) const {
 		assert(memory);
-#if LOG
-		std::clog << "Output string (Buffer " << std::hex << state.Z_Z80_STATE_MEMBER_DE << "h)" << std::endl;
-#endif
-		const auto* c = memory + state.Z_Z80_STATE_MEMBER_DE;
-		while (*c != '$') {
-			std::cout << char(*(c++));
+		if (Log::enabled()) {
+			std::clog << "Output string (Buffer " << std::hex << state.Z_Z80_STATE_MEMBER_DE << "h)" << std::dec << std::endl;
+		}
+		constexpr size_t SIZE = MEMORY_SIZE * 1024;
+		const size_t from = state.Z_Z80_STATE_MEMBER_DE;
+		if (from < SIZE) {
+			const auto begin = reinterpret_cast<const char*>(memory);
+			const auto end = static_cast<const char*>(memchr(begin + from, '$', SIZE - from));
+			if (end) {
+				console.write(begin + from, end - begin - from);
+			} else {
+		// No terminator up to the memory end: the address wraps at 64K, and
+		// the string is written out once at most.
+				console.write(begin + from, SIZE - from);
+				if (SIZE == 0x10000) {
+					const auto wrap = static_cast<const char*>(memchr(begin, '$', from));
+					console.write(begin, wrap ? wrap - begin : from);
+				}
+			}
 		}
 		returnCode(state, 0);
 	}
@@ -275,14 +400,12 @@ protected:
  */
 	void readConsoleBuffer(ZZ80State& state, uint8_t memory[]) {
 		assert(memory);
-#if LOG
-		std::clog << "Buffered console input (Buffer " << std::hex << state.Z_Z80_STATE_MEMBER_DE << "h)" << std::endl;
+		if (Log::enabled()) {
+			std::clog << "Buffered console input (Buffer " << std::hex << state.Z_Z80_STATE_MEMBER_DE << "h)" << std::dec << std::endl;
 //			std::clog << "mx" << unsigned(memory[DE+0]) << std::endl;
 //			std::clog << "nc" << unsigned(memory[DE+1]) << std::endl;
-#endif			
-		std::string line;
-		std::getline(std::cin, line);
-		line = line.substr(0, memory[state.Z_Z80_STATE_MEMBER_DE]);
+		}
+		const auto line = console.getLine(memory[state.Z_Z80_STATE_MEMBER_DE]);
 
 		memory[state.Z_Z80_STATE_MEMBER_DE + 1] = line.length();
 		auto* s = memory + state.Z_Z80_STATE_MEMBER_DE + 2;
@@ -297,17 +420,10 @@ protected:
  * Returns A=0 if no characters are waiting, nonzero if a character is waiting.
  */
 	void getConsoleStatus(ZZ80State& state) {
-#if LOG
-		std::clog << "Console status" << std::endl;
-#endif
-		char c;
-		const auto n = std::cin.readsome(&c, 1);
-		if (!n) {
-			returnCode(state, 0x00);
-		} else {
-			std::cin.putback(c);
-			returnCode(state, 0xFF);
+		if (Log::enabled()) {
+			std::clog << "Console status" << std::endl;
 		}
+		returnCode(state, console.status() ? 0xFF : 0x00);
 	}
 	
 /**
@@ -332,9 +448,9 @@ protected:
  * It is interesting to note that the version numbers returned by DRDOS and Novell DOS follow this system; DRDOS 3, 5 and 6 are version 6.x, Novell DOS 7 is version 7.2 and DR-OpenDOS is version 7.3. However these systems rather unsportingly fail to provide an INT 0E0h call to get the version number; you have to use INT 21h with AX=4452h.
  */
 	void returnVersionNumber(ZZ80State& state) {
-#if LOG
-		std::clog << "Version number CP/M 2.2" << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Version number CP/M 2.2" << std::endl;
+		}
 		returnCode(state, 0x0022);	// hard coded CPM 2.2
 	}
 	
@@ -348,9 +464,9 @@ protected:
  */
 	void resetDiskSystem(ZZ80State& state, uint8_t memory[]) {
 		assert(memory);
-#if LOG
-		std::clog << "Reset drive ; default to A" << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Reset drive ; default to A" << std::endl;
+		}
 		memory[USER_DRIVE] = 0x00;	// USER: 0, DRIVE: 0 (A)
 		dma = 0x80;
 		returnCode(state, 0);
@@ -365,9 +481,9 @@ protected:
  */
  	void selectDisk(ZZ80State& state, uint8_t memory[]) {
 		assert(memory);
-#if LOG
-		std::clog << "Select disc to " << char('A' + state.Z_Z80_STATE_MEMBER_E) << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Select disc to " << char('A' + state.Z_Z80_STATE_MEMBER_E) << std::endl;
+		}
 		if (state.Z_Z80_STATE_MEMBER_E > 15) {
 			std::cerr << ">> Invalid disk (A-P only)!" << std::endl;
 			returnCode(state, 0xFF);
@@ -401,29 +517,31 @@ protected:
  *  * F7' is set if the file is read-only because writing is password protected and no password was supplied;
  *  * F8' is set if the file is read-only because it is a User 0 system file opened from another user area.
  */
-	void openFile(ZZ80State& state, const uint8_t memory[]) {
+	void openFile(ZZ80State& state, uint8_t memory[]) {
 		assert(memory);
-		const FCB_t *const pFCB = reinterpret_cast<const FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
+		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
 		char filename[15];	// DIR + "/" + NAME + "." + EXT
 		fcbToFilename(pFCB, (memory[USER_DRIVE] & 0x0F), filename);
 
-#if LOG
-		std::clog << "Open file " << '"' << filename << "\" (FCB: "
-				  << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h) "
-				  << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Open file " << '"' << filename << "\" (FCB: "
+					  << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h) "
+					  << std::dec << std::endl;
+		}
 
-		std::fstream& s = getStream(state.Z_Z80_STATE_MEMBER_DE);
-		s.close();	// in case of...
-		s.open(filename, std::ios::binary|std::ios::in);	// Open RO !
-		if (!s) {
+		FileHandle& h = getHandle(state.Z_Z80_STATE_MEMBER_DE);
+		if (!h.open(filename, false, fcbShare(*pFCB), isText(*pFCB, memory), &WritePolicy::drive(fcbDrive(*pFCB, memory)))) {
 			std::cerr << ">> Error opening file '" << filename << "': "
 					  << strerror(errno) << "!" << std::endl;
 			returnCode(state, 0xFF);
-			releaseStream(state.Z_Z80_STATE_MEMBER_DE);
+			releaseHandle(state.Z_Z80_STATE_MEMBER_DE);
 			return;
 		}
-//		memcpy(pFCB->AL, &ps, sizeof(ps));
+		pFCB->RC = extentRecords(fcbRecord(*pFCB) & ~0x7FU, h.records());
+		if (fcbShare(*pFCB) == FileHandle::Share::UNLOCKED) {	// File ID
+			pFCB->R[0] = state.Z_Z80_STATE_MEMBER_E;
+			pFCB->R[1] = state.Z_Z80_STATE_MEMBER_D;
+		}
 		returnCode(state, 0x00);
 	}
 
@@ -439,20 +557,17 @@ protected:
  	void closeFile(ZZ80State& state, uint8_t memory[]) {
 		assert(memory);
 //		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
-#if LOG
-		std::clog << "Close file (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::endl;
-#endif
-/*
-		std::fstream* ps;
-		memcpy(&ps, pFCB->AL, sizeof(ps));
-*/
-		std::fstream& s = getStream(state.Z_Z80_STATE_MEMBER_DE);
-		s.close();
-		if (s.is_open()) {
+		if (Log::enabled()) {
+			std::clog << "Close file (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
+		FileHandle *const h = findHandle(state.Z_Z80_STATE_MEMBER_DE);
+		if (!h) {
+			returnCode(state, 0x00);	// Nothing opened, nothing to write
+		} else if (!h->close()) {
 			std::cerr << ">> Error closing file: " << strerror(errno) << "!" << std::endl;
 			returnCode(state, 0xFF);	// KO
 		} else {
-			releaseStream(state.Z_Z80_STATE_MEMBER_DE);
+			releaseHandle(state.Z_Z80_STATE_MEMBER_DE);
 			returnCode(state, 0x00);	// OK
 		}
 	}
@@ -467,9 +582,9 @@ protected:
 	void searchForFirst(ZZ80State& state, uint8_t memory[]) {
 		assert(memory);
 		const FCB_t *const pFCB = reinterpret_cast<const FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
-#if LOG
-		std::clog << "Search for first (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Search for first (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
 		const char dir[] = { char('A' + (pFCB->DR ? pFCB->DR-1 : (memory[USER_DRIVE] & 0x0F))), '/', '\0' };
 
 		memcpy(filter, pFCB->filename, 11);
@@ -507,9 +622,9 @@ protected:
 	void searchForNext(ZZ80State& state, uint8_t memory[]) {
 		assert(memory);
 		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
-#if LOG
-		std::clog << "Search for next (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Search for next (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
 
 		char filename[12];
 		if (findFile(di, filter, filename)) {
@@ -527,9 +642,9 @@ protected:
  */
  	void deleteFile(ZZ80State& state, uint8_t *const memory) {
 		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
-#if LOG
-		std::clog << "Delete file (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Delete file (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
 		const char dir[] = { char('A' + (pFCB->DR ? pFCB->DR-1 : (memory[USER_DRIVE]) & 0x0F)), '/', '\0' };
 
 		char filter[12];
@@ -576,65 +691,67 @@ protected:
  */
  	void readSequential(ZZ80State& state, uint8_t memory[]) {
 		assert(memory);
-//		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
-#if LOG
-		std::clog << "Read next record (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::endl;
-#endif
+		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
+		if (Log::enabled()) {
+			std::clog << "Read next record (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
 		if (dma + SECTOR_SIZE >= MEMORY_SIZE * 1024) {
 			std::cerr << ">> Writing DMA out of memory!" << std::endl;
 			returnCode(state, 0xFF);	// OK
 			return;
 		}
-		std::fstream& s = getStream(state.Z_Z80_STATE_MEMBER_DE);
-		s.read(reinterpret_cast<char*>(memory + dma), SECTOR_SIZE);
-		if (s) {
-			returnCode(state, 0x00);	// OK
+		FileHandle *const h = findHandle(state.Z_Z80_STATE_MEMBER_DE);
+		if (!h) {
+			std::cerr << ">> Reading a file not opened!" << std::endl;
+			returnCode(state, 0x09);	// Invalid FCB
+			return;
+		}
+		const auto record = fcbRecord(*pFCB);
+		const auto n = h->read(record, memory + dma);
+		if (n < 0) {
+			std::cerr << ">> Error reading: " << strerror(errno) << "!" << std::endl;
+			returnCode(state, 0xFF);	// KO
+		} else if (n == 0) {
+			returnCode(state, 0x01);	// EOF - Nothing read
 		} else {
-			if (s.eof()) {
-				if (s.gcount()) {		// few read
-					memset(memory + s.gcount(), 0xE5, SECTOR_SIZE - s.gcount());	// padding with 0xE5
-					returnCode(state, 0x00);	// OK - May be partial read
-				} else {
-					returnCode(state, 0x01);	// EOF - Nothing read
-				} 
-			} else {
-				std::cerr << ">> Error reading: " << strerror(errno) << "!" << std::endl;
-				
-				std::cerr << ">> " << s.gcount() << " bytes read" << std::endl;
-				std::cerr << ">> good: " << s.good() << std::endl;
-				std::cerr << ">> fail: " << s.fail() << std::endl;
-				std::cerr << ">> bad: " << s.bad() << std::endl;
-				std::cerr << ">> eof: " << s.eof() << std::endl;
-				returnCode(state, 0xFF);	// OK
+			if (unsigned(n) < SECTOR_SIZE) {	// few read
+				memset(memory + dma + n, TextMode::CTRL_Z, SECTOR_SIZE - n);	// padding with ^Z
 			}
+			setFcbRecord(*pFCB, record + 1, h->records());
+			returnCode(state, 0x00);	// OK - May be partial read
 		}
 	}
 
 /**
- * BDOS function 21
+ * BDOS function 21 (F_WRITE) - write next record
+ * Supported by: All versions
+ * Entered with C=15h, DE=address of FCB. Returns error codes in BA and HL.
+ * Write a record (normally 128 bytes, but under CP/M 3 this can be a multiple of 128 bytes) from the previously specified DMA address to the file at the FCB position (CR, EX, S2), then move to the next record.
  */
 	void writeSequential(ZZ80State& state, uint8_t memory[]) {
 		assert(memory);
-//		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
-#if LOG
-		std::clog << "Write next record (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::endl;
-#endif
+		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
+		if (Log::enabled()) {
+			std::clog << "Write next record (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
 		if (dma + SECTOR_SIZE >= MEMORY_SIZE * 1024) {
 			std::cerr << ">> Reading DMA out of memory!" << std::endl;
 			returnCode(state, 0xFF);	// KO
 			return;
 		}
-		std::fstream& s = getStream(state.Z_Z80_STATE_MEMBER_DE);
-		s.write(reinterpret_cast<char*>(memory + dma), SECTOR_SIZE);
-		if (!s) {
+		FileHandle *const h = findHandle(state.Z_Z80_STATE_MEMBER_DE);
+		if (!h) {
+			std::cerr << ">> Writing a file not opened!" << std::endl;
+			returnCode(state, 0x09);	// Invalid FCB
+			return;
+		}
+		const auto record = fcbRecord(*pFCB);
+		if (!h->write(record, memory + dma)) {
 			std::cerr << ">> Error writing: " << strerror(errno) << "!" << std::endl;
-			std::cerr << ">> good: " << s.good() << std::endl;
-			std::cerr << ">> fail: " << s.fail() << std::endl;
-			std::cerr << ">> bad: " << s.bad() << std::endl;
-			std::cerr << ">> eof: " << s.eof() << std::endl;
-			returnCode(state, 0xFF);	// KO
+			returnCode(state, FileHandle::isConflict(errno) ? 0x08 : 0xFF);	// Locked by another session / KO
 			return;
 		}
+		setFcbRecord(*pFCB, record + 1, h->records());
 		returnCode(state, 0x00);	// OK
 	}
 	
@@ -652,9 +769,9 @@ protected:
 	void makeFile(ZZ80State& state, uint8_t memory[]) {
 		assert(memory);
 		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
-#if LOG
-		std::clog << "Make file (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Make file (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
 		char filename[15];	// DIR + "/" + NAME + "." + EXT
 		fcbToFilename(pFCB, (memory[USER_DRIVE] & 0x0F), filename);
 		
@@ -664,15 +781,13 @@ protected:
 			std::cerr << ">> Error creating file '" << filename << "': Already existing file!" << std::endl;
 			returnCode(state, 0xFF);
 		} else {			// New file (find.)
-			std::fstream& sOut = getStream(state.Z_Z80_STATE_MEMBER_DE);
-			sOut.close();	// in case of...
-			sOut.open(filename, std::ios::binary|std::ios::out|std::ios::in|std::ios::trunc);	// create if not exists
-			if (!sOut) {	// fail to open!
+			FileHandle& h = getHandle(state.Z_Z80_STATE_MEMBER_DE);
+			if (!h.open(filename, true, fcbShare(*pFCB), isText(*pFCB, memory), &WritePolicy::drive(fcbDrive(*pFCB, memory)))) {	// fail to open!
 				std::cerr << ">> Error opening file '" << filename << "': " << strerror(errno) << "!" << std::endl;
 				returnCode(state, 0xFF);
-				releaseStream(state.Z_Z80_STATE_MEMBER_DE);
+				releaseHandle(state.Z_Z80_STATE_MEMBER_DE);
 			} else {	// Success opening.
-//				memcpy(pFCB->AL, &ps, sizeof(ps));
+				pFCB->RC = 0;
 				returnCode(state, 0x00);
 			}
 		}
@@ -696,9 +811,9 @@ protected:
  */ 
  
  	void returnLogicVector(ZZ80State& state) {
-#if LOG
-		std::clog << "Return Logic Vector (actives disks)" << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Return Logic Vector (actives disks)" << std::endl;
+		}
 		uint16_t actives = 0;
 		for (auto d = 0; d <= 15; ++d) {
 			const char dir[] = { char('A' + d), '\0' };
@@ -716,9 +831,9 @@ protected:
  */
  	void returnCurrentDisk(ZZ80State& state, const uint8_t memory[]) {
 		assert(memory);
-#if LOG
-		std::clog << "Get drive (" << char('A' + (memory[USER_DRIVE] & 0x0F)) << ')' << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Get drive (" << char('A' + (memory[USER_DRIVE] & 0x0F)) << ')' << std::endl;
+		}
 		returnCode(state, (memory[USER_DRIVE] & 0x0F));	// ok - drive numb.
 	}
 
@@ -729,9 +844,9 @@ protected:
  * Set the Direct Memory Access address; a pointer to where CP/M should read or write data. Initially used for the transfer of 128-byte records between memory and disc, but over the years has gained many more functions.
  */
  	void setDMAAddress(ZZ80State& state) {
-#if LOG
-		std::clog << "Set DMA address  (" << std::hex << state.Z_Z80_STATE_MEMBER_DE << ')' << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Set DMA address  (" << std::hex << state.Z_Z80_STATE_MEMBER_DE << ')' << std::dec << std::endl;
+		}
 		dma = state.Z_Z80_STATE_MEMBER_DE;
 		returnCode(state, 0);	// OK
 	}
@@ -762,9 +877,9 @@ protected:
  * Bit 7 of H corresponds to P: while bit 0 of L corresponds to A:. A bit is set if the corresponding drive is set to read-only in software.
  */
 	void getROVector(ZZ80State& state) {
-#if LOG
-		std::clog << "Return RO Vector (read-only disks)" << std::endl;
-#endif
+		if (Log::enabled()) {
+			std::clog << "Return RO Vector (read-only disks)" << std::endl;
+		}
 		uint16_t ro = 0;
 		for (auto d = 0; d <= 15; ++d) {
 			const char dir[] = { char('A' + d), '\0' };
@@ -808,38 +923,135 @@ protected:
 	void setGetUserCode(ZZ80State& state, uint8_t memory[]) {
 		assert(memory);
 		if (state.Z_Z80_STATE_MEMBER_E == 0xFF) {
-#if LOG
-			std::clog << "Get user number (" << unsigned(memory[USER_DRIVE] >> 4) << ")" << std::endl;
-#endif
+			if (Log::enabled()) {
+				std::clog << "Get user number (" << unsigned(memory[USER_DRIVE] >> 4) << ")" << std::endl;
+			}
 			returnCode(state, memory[USER_DRIVE] >> 4);	// OK - user numb.
 		} else {
-#if LOG
-			std::clog << "Set user number to " << unsigned(state.Z_Z80_STATE_MEMBER_E) << std::endl;
-#endif
+			if (Log::enabled()) {
+				std::clog << "Set user number to " << unsigned(state.Z_Z80_STATE_MEMBER_E) << std::endl;
+			}
 			memory[USER_DRIVE] = (memory[USER_DRIVE] & 0x0F) | state.Z_Z80_STATE_MEMBER_E << 4;
 			returnCode(state, 0);	// OK
 		}
 	}
 
 /**
- * BDOS function 33
+ * BDOS function 33 (F_READRAND) - Random access read record
+ * Supported by: CP/M 2 and later.
+ * Entered with C=21h, DE=FCB address. Returns error codes in BA and HL.
+ * Read the record specified in the random record count area of the FCB, at the DMA address. The pointers in the FCB will be updated so that the next record to read using the sequential I/O calls will be the record just read. Error numbers returned are:
+ *   0 OK
+ *   1 Reading unwritten data
+ *   4 Reading unwritten extent (a 16k portion of file does not exist)
+ *   6 Record number out of range
+ *   9 Invalid FCB
  */
-	void readRandom(ZZ80State& state, uint8_t *const memory);
+	void readRandom(ZZ80State& state, uint8_t memory[]) {
+		assert(memory);
+		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
+		if (Log::enabled()) {
+			std::clog << "Read random record (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
+		if (dma + SECTOR_SIZE >= MEMORY_SIZE * 1024) {
+			std::cerr << ">> Writing DMA out of memory!" << std::endl;
+			returnCode(state, 0xFF);	// KO
+			return;
+		}
+		FileHandle *const h = findHandle(state.Z_Z80_STATE_MEMBER_DE);
+		if (!h) {
+			std::cerr << ">> Reading a file not opened!" << std::endl;
+			returnCode(state, 0x09);	// Invalid FCB
+			return;
+		}
+		if (pFCB->R[2]) {
+			returnCode(state, 0x06);	// Out of range
+			return;
+		}
+		const uint32_t record = pFCB->R[0] | (pFCB->R[1] << 8);
+		const auto n = h->read(record, memory + dma);
+		if (n < 0) {
+			std::cerr << ">> Error reading: " << strerror(errno) << "!" << std::endl;
+			returnCode(state, 0xFF);	// KO
+			return;
+		}
+		setFcbRecord(*pFCB, record, h->records());
+		if (n == 0) {
+			returnCode(state, (record & ~0x7FU) < h->records() ? 0x01 : 0x04);	// Unwritten data / extent
+			return;
+		}
+		if (unsigned(n) < SECTOR_SIZE) {	// few read
+			memset(memory + dma + n, TextMode::CTRL_Z, SECTOR_SIZE - n);	// padding with ^Z
+		}
+		returnCode(state, 0x00);	// OK
+	}
 
 /**
- * BDOS function 34
+ * BDOS function 34 (F_WRITERAND) - Random access write record
+ * Supported by: CP/M 2 and later.
+ * Entered with C=22h, DE=FCB address. Returns error codes in BA and HL.
+ * Write the record specified in the random record count area of the FCB, from the DMA address. The pointers in the FCB will be updated so that the next record to write using the sequential I/O calls will be the record just written. Error numbers returned are:
+ *   0 OK
+ *   2 Disc full
+ *   6 Record number out of range
+ *   9 Invalid FCB
+ * Records not written between the previous end of file and this record read as zeros.
  */
-	void writeRandom(ZZ80State& state, uint8_t *const memory);
+	void writeRandom(ZZ80State& state, uint8_t memory[]) {
+		writeRandom(state, memory, false);
+	}
 
 /**
- * BDOS function 35
+ * BDOS function 35 (F_SIZE) - Compute file size
+ * Supported by: CP/M 2 and later.
+ * Entered with C=23h, DE=FCB address. Returns error codes in BA and HL.
+ * Set the random record count bytes of the FCB to the number of 128-byte records in the file. Returns A=0FFh if error (file not found), else 0.
  */
-	void computeFileSize(ZZ80State& state, uint8_t *const memory);
+	void computeFileSize(ZZ80State& state, uint8_t memory[]) {
+		assert(memory);
+		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
+		if (Log::enabled()) {
+			std::clog << "Compute file size (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
+		uint32_t records;
+		const FileHandle *const h = findHandle(state.Z_Z80_STATE_MEMBER_DE);
+		if (h) {	// Opened: pending writes are not on disk yet
+			records = h->records();
+		} else {
+			char filename[15];	// DIR + "/" + NAME + "." + EXT
+			fcbToFilename(pFCB, (memory[USER_DRIVE] & 0x0F), filename);
+			std::error_code ec;
+			auto size = std::filesystem::file_size(filename, ec);
+			if (ec) {
+				std::cerr << ">> Error sizing file '" << filename << "': " << ec.message() << "!" << std::endl;
+				returnCode(state, 0xFF);	// KO
+				return;
+			}
+			if (isText(*pFCB, memory)) {	// Size of the image it gets when opened
+				std::ifstream in(filename, std::ios::binary);
+				size = TextMode::cpmSize(in);
+			}
+			records = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+		}
+		setRandomRecord(*pFCB, records);
+		returnCode(state, 0x00);	// OK
+	}
 
 /**
- * BDOS function 36
+ * BDOS function 36 (F_RANDREC) - Update random access pointer
+ * Supported by: CP/M 2 and later.
+ * Entered with C=24h, DE=FCB address. Returns error codes in BA and HL.
+ * Set the random access record count bytes of the FCB to the number of the last record read/written by the sequential I/O calls.
  */
-	void setRandomRecord(ZZ80State& state, uint8_t *const memory);
+	void setRandomRecord(ZZ80State& state, uint8_t memory[]) {
+		assert(memory);
+		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
+		if (Log::enabled()) {
+			std::clog << "Set random record (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
+		setRandomRecord(*pFCB, fcbRecord(*pFCB));
+		returnCode(state, 0x00);	// OK
+	}
 
 /**
  * BDOS function 37
@@ -847,48 +1059,223 @@ protected:
 	void resetDrive(ZZ80State& state, uint8_t *const memory);
 
 /**
- * BDOS function 40
+ * BDOS function 40 (F_WRITEZF) - Write random with zero fill
+ * Supported by: CP/M 2.2 and later.
+ * Entered with C=28h, DE=FCB address. Returns error codes in BA and HL.
+ * If the random write is to a newly allocated block, the block is filled with zeros before the data are written. Error codes as function 34.
  */
-	void writeRandomWithZeroFill(ZZ80State& state, uint8_t *const memory);
+	void writeRandomWithZeroFill(ZZ80State& state, uint8_t memory[]) {
+		writeRandom(state, memory, true);
+	}
 
+/**
+ * Random access write record, shared by functions 34 & 40.
+ * @param aZeroFill Write zeroed records between the end of file and the record.
+ */
+	void writeRandom(ZZ80State& state, uint8_t memory[], const bool aZeroFill) {
+		assert(memory);
+		FCB_t *const pFCB = reinterpret_cast<FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
+		if (Log::enabled()) {
+			std::clog << "Write random record (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
+		if (dma + SECTOR_SIZE >= MEMORY_SIZE * 1024) {
+			std::cerr << ">> Reading DMA out of memory!" << std::endl;
+			returnCode(state, 0xFF);	// KO
+			return;
+		}
+		FileHandle *const h = findHandle(state.Z_Z80_STATE_MEMBER_DE);
+		if (!h) {
+			std::cerr << ">> Writing a file not opened!" << std::endl;
+			returnCode(state, 0x09);	// Invalid FCB
+			return;
+		}
+		if (pFCB->R[2]) {
+			returnCode(state, 0x06);	// Out of range
+			return;
+		}
+		const uint32_t record = pFCB->R[0] | (pFCB->R[1] << 8);
+		if ((aZeroFill && !h->zeroFill(record)) || !h->write(record, memory + dma)) {
+			std::cerr << ">> Error writing: " << strerror(errno) << "!" << std::endl;
+			returnCode(state, FileHandle::isConflict(errno) ? 0x08 : 0xFF);	// Locked by another session / KO
+			return;
+		}
+		setFcbRecord(*pFCB, record, h->records());
+		returnCode(state, 0x00);	// OK
+	}
 
+/**
+ * BDOS function 42 (F_LOCK) - Lock record
+ * Supported by: MP/M, CP/M 3 and later.
+ * Entered with C=2Ah, DE=FCB address. Returns error codes in BA and HL.
+ * Lock the record given by the random record field of the FCB. The file should have been opened in unlocked mode (F5'), otherwise the call always succeeds. Error numbers returned are:
+ *   0 OK
+ *   6 Record number out of range
+ *   8 Record locked by another process
+ *   9 Invalid FCB
+ */
+	void lockRecord(ZZ80State& state, uint8_t memory[]) {
+		lockRecord(state, memory, true);
+	}
 
 /**
- * Return a free fstream and set it as occuped.
- * @return a reference on a free fstream.
+ * BDOS function 43 (F_UNLOCK) - Unlock record
+ * Supported by: MP/M, CP/M 3 and later.
+ * Entered with C=2Bh, DE=FCB address. Returns error codes in BA and HL.
+ * Unlock the record given by the random record field of the FCB, previously locked by function 42. Error numbers as function 42.
  */
-	std::fstream& getStream(const uint16_t aFCB) {
-		assert(aFCB);
-		for (auto i = 0; i < 10; ++i) {
-			if (FCB[i] == aFCB) return *fileStream[i];
+	void unlockRecord(ZZ80State& state, uint8_t memory[]) {
+		lockRecord(state, memory, false);
+	}
+
+/**
+ * Lock or unlock a record, shared by functions 42 & 43.
+ * @param aLock true to lock, false to unlock.
+ */
+	void lockRecord(ZZ80State& state, uint8_t memory[], const bool aLock) {
+		assert(memory);
+		const FCB_t *const pFCB = reinterpret_cast<const FCB_t *const>(memory + state.Z_Z80_STATE_MEMBER_DE);
+		if (Log::enabled()) {
+			std::clog << (aLock ? "Lock" : "Unlock") << " record (FCB: " << std::hex << unsigned(state.Z_Z80_STATE_MEMBER_DE) << "h)" << std::dec << std::endl;
+		}
+		FileHandle *const h = findHandle(state.Z_Z80_STATE_MEMBER_DE);
+		if (!h) {
+			returnCode(state, 0x09);	// Invalid FCB
+			return;
+		}
+		if (pFCB->R[2]) {
+			returnCode(state, 0x06);	// Out of range
+			return;
 		}
-		for (auto i = 0; i < 10; ++i) {
-			if (fileStream[i] == NULL) {
-				fileStream[i] = new std::fstream;
+		const uint32_t record = pFCB->R[0] | (pFCB->R[1] << 8);
+		if (aLock ? h->lock(record) : h->unlock(record)) {
+			returnCode(state, 0x00);	// OK
+		} else if (FileHandle::isConflict(errno)) {
+			returnCode(state, 0x08);	// Locked by another session
+		} else {
+			std::cerr << ">> Error locking: " << strerror(errno) << "!" << std::endl;
+			returnCode(state, 0xFF);	// KO
+		}
+	}
+
+/**
+ * Return the handle associated with a FCB, allocating a free one if needed.
+ * @param aFCB FCB address.
+ * @return a reference on the handle.
+ */
+	FileHandle& getHandle(const uint16_t aFCB) {
+		assert(aFCB);
+		FileHandle *const h = findHandle(aFCB);
+		if (h) return *h;
+		for (auto i = 0; i < MAX_HANDLES; ++i) {
+			if (fileHandle[i] == NULL) {
+				fileHandle[i] = new FileHandle;
 				FCB[i] = aFCB;
-				return *fileStream[i];
+				return *fileHandle[i];
 			}
 		}
-		std::cerr << "Can't get another stream in BDOS::getStream!" << std::endl;
-		throw(std::runtime_error("Can't get another stream in BDOS::getStream!"));
+		std::cerr << "Can't get another handle in BDOS::getHandle!" << std::endl;
+		throw(std::runtime_error("Can't get another handle in BDOS::getHandle!"));
+	}
+
+/**
+ * Return the handle associated with a FCB.
+ * @param aFCB FCB address.
+ * @return a pointer on the handle, NULL if the FCB has no opened file.
+ */
+	FileHandle* findHandle(const uint16_t aFCB) const {
+		for (auto i = 0; i < MAX_HANDLES; ++i) {
+			if (FCB[i] == aFCB) return fileHandle[i];
+		}
+		return NULL;
 	}
 	
 /**
- * Release the fstream sent.
- * @param sStream a fstream to be released.
+ * Release the handle associated with a FCB.
+ * @param aFCB FCB address.
  */
-	void releaseStream(const uint16_t aFCB) {
+	void releaseHandle(const uint16_t aFCB) {
 		assert(aFCB);
-		for (auto i = 0; i < 10; ++i) {
+		for (auto i = 0; i < MAX_HANDLES; ++i) {
 			if (FCB[i] == aFCB) {
-				delete fileStream[i];
-				fileStream[i] = NULL;
+				delete fileHandle[i];
+				fileHandle[i] = NULL;
 				FCB[i] = 0;
 				return;
 			}
 		}
-		std::cerr << "Can't release this stream in BDOS::getStream!" << std::endl;
-		throw(std::runtime_error("Can't release this stream in BDOS::getStream!"));
+		std::cerr << "Can't release this handle in BDOS::releaseHandle!" << std::endl;
+		throw(std::runtime_error("Can't release this handle in BDOS::releaseHandle!"));
+	}
+
+/**
+ * Release all the handles (closing their files).
+ */
+	void releaseHandles() {
+		for (auto i = 0; i < MAX_HANDLES; ++i) {
+			delete fileHandle[i];
+			fileHandle[i] = NULL;
+			FCB[i] = 0;
+		}
+	}
+
+/**
+ * Record number pointed by the sequential access fields of a FCB.
+ * CR may be 128 after the last record of an extent has been read: it then
+ * points the first record of the next extent.
+ */
+	static uint32_t fcbRecord(const FCB_t& aFCB) {
+		return (uint32_t(aFCB.S2 & 0x3F) << 12) + (uint32_t(aFCB.EX & 0x1F) << 7) + aFCB.CR;
+	}
+
+/**
+ * Set the sequential access fields of a FCB (CR, EX, S2 & RC) to a record.
+ * @param aRecord Record number.
+ * @param aRecords File size, in records.
+ */
+	static void setFcbRecord(FCB_t& aFCB, const uint32_t aRecord, const uint32_t aRecords) {
+		aFCB.S2 = (aFCB.S2 & 0xC0) | ((aRecord >> 12) & 0x3F);
+		aFCB.EX = (aRecord >> 7) & 0x1F;
+		aFCB.CR = aRecord & 0x7F;
+		aFCB.RC = extentRecords(aRecord & ~0x7FU, aRecords);
+	}
+
+/**
+ * Number of records in the extent starting at a record (RC field).
+ */
+	static uint8_t extentRecords(const uint32_t aFirst, const uint32_t aRecords) {
+		return aRecords > aFirst ? std::min(aRecords - aFirst, 0x80U) : 0;
+	}
+
+/**
+ * @return the drive number of a FCB (0 for A:).
+ */
+	static unsigned fcbDrive(const FCB_t& aFCB, const uint8_t memory[]) {
+		return aFCB.DR ? aFCB.DR - 1 : (memory[USER_DRIVE] & 0x0F);
+	}
+
+/**
+ * @return true if the file of a FCB is translated as text (see TextMode).
+ */
+	static bool isText(const FCB_t& aFCB, const uint8_t memory[]) {
+		return TextMode::isText(fcbDrive(aFCB, memory), aFCB.filetype);
+	}
+
+/**
+ * Sharing mode asked by the interface attributes of a FCB (F6' wins over F5').
+ */
+	static FileHandle::Share fcbShare(const FCB_t& aFCB) {
+		if (aFCB.filename[5] & 0x80) return FileHandle::Share::READ_ONLY;
+		if (aFCB.filename[4] & 0x80) return FileHandle::Share::UNLOCKED;
+		return FileHandle::Share::EXCLUSIVE;
+	}
+
+/**
+ * Set the random record fields of a FCB (R0, R1 & R2).
+ */
+	static void setRandomRecord(FCB_t& aFCB, const uint32_t aRecord) {
+		aFCB.R[0] = aRecord & 0xFF;
+		aFCB.R[1] = (aRecord >> 8) & 0xFF;
+		aFCB.R[2] = (aRecord >> 16) & 0xFF;
 	}
 
 /**
@@ -913,14 +1300,14 @@ protected:
  */
 	void filenameCPM2DOS(const char cpm[11], char dos[]) const {
 		char name[9];
-		memcpy(name, cpm, 8);
+		for (auto i = 0; i < 8; ++i) name[i] = cpm[i] & 0x7F;	// strip attributes
 		name[8] = '\0';
 		
 		for (auto i = 7; (i >= 0) && (name[i] == ' '); --i) name[i] = '\0';
 		strcpy(dos, name);
 		
 		char ext[4];
-		memcpy(ext, cpm + 8, 3);
+		for (auto i = 0; i < 3; ++i) ext[i] = cpm[8 + i] & 0x7F;
 
 		if (ext[2] == ' ') {
 			if (ext[1] == ' ') {
@@ -993,6 +1380,17 @@ protected:
 	}
 
 private:
+/**
+ * Console & devices shared with the BIOS.
+ */
+	Console& console;
+	Devices& devices;
+
+/**
+ * Next init is the cold boot.
+ */
+	bool cold = true;
+
 /**
  * Sector size (fixed to 128 for CP/M 2.2.
  */
@@ -1003,6 +1401,11 @@ private:
  */
 	static constexpr auto USER_DRIVE = 4U;
 
+/**
+ * IOBYTE address, routing the logical devices (see Devices).
+ */
+	static constexpr auto IOBYTE = 3U;
+
 /**
  * DMA's address.
  */
@@ -1018,14 +1421,19 @@ private:
  */
 	char filter[12] = "";
 	
+/**
+ * Number of files opened at once (host descriptors are limited by FileHandle::setBudget, see --files).
+ */
+	static constexpr auto MAX_HANDLES = 32;
+
 /**
  * List of FCB
  */
-	uint16_t FCB[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	uint16_t FCB[MAX_HANDLES] = {};
 
 /**
- * List of fstream associated with FCBs.
+ * List of handles associated with FCBs.
  */
-	std::fstream* fileStream[10] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+	FileHandle* fileHandle[MAX_HANDLES] = {};
 
 };
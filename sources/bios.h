@@ -26,6 +26,10 @@
 // #include <filesystem>
 
 // #define LOG 1
+
+#include "console.h"
+#include "device.h"
+
 /**
  * @see https://www.seasip.info/Cpm/bios.html#const
  * 	JMP	BOOT	;-3: Cold start routine
@@ -49,10 +53,22 @@
 template <unsigned MEMORY_SIZE, uint16_t BIOS_ADDR>
 class BIOS {
 public:
-	BIOS() {
-		std::cout << "CP/M 2.2 Emulator " << MEMORY_SIZE << "kb" << std::endl;
-		std::cout << "Copyright (c) 2021 by M. Sibert" << std::endl;
-		std::cout << std::endl;
+/**
+ * @param aConsole Console shared with the BDOS.
+ * @param aDevices LIST, PUNCH & READER devices shared with the BDOS.
+ */
+	BIOS(Console& aConsole, Devices& aDevices) :
+		console(aConsole),
+		devices(aDevices) {
+	}
+
+/**
+ * Print out the copyright text.
+ */
+	static void banner(std::ostream& aOut) {
+		aOut << "CP/M 2.2 Emulator " << MEMORY_SIZE << "kb" << std::endl;
+		aOut << "Copyright (c) 2021 by M. Sibert" << std::endl;
+		aOut << std::endl;
 	}
 	
 	void init(uint8_t *const memory) {
@@ -68,6 +84,42 @@ public:
 		}
 	}
 
+/**
+ * Check if a function can run without waiting for the console input, so that
+ * the machine is suspended instead.
+ * @return true if the function won't wait.
+ */
+	bool ready(const ZZ80State& state, const uint8_t memory[]) {
+		switch (state.Z_Z80_STATE_MEMBER_PC) {
+			case CONIN_ADDR : return console.ready();
+			case READER_ADDR : return !Devices::readsConsole(memory[IOBYTE]) || console.ready();
+			default : return true;
+		}
+	}
+
+/**
+ * @return the name of the BIOS function at an address of the jump vector
+ *         (e.g. "CONOUT"), or NULL.
+ */
+	static const char* name(const uint16_t aAddr) {
+		static const char* const NAMES[] = {
+			"BOOT", "WBOOT", "CONST", "CONIN", "CONOUT", "LIST", "PUNCH", "READER", "HOME",
+			"SELDSK", "SETTRK", "SETSEC", "SETDMA", "READ", "WRITE", "LISTST", "SECTRAN"
+		};
+		const unsigned i = (aAddr - BIOS_ADDR) / 3;
+		return ((aAddr >= BIOS_ADDR) && !((aAddr - BIOS_ADDR) % 3) && (i < sizeof(NAMES) / sizeof(NAMES[0]))) ? NAMES[i] : NULL;
+	}
+
+/**
+ * @return the characters moved by the BIOS function at an address.
+ */
+	static unsigned transferred(const uint16_t aAddr) {
+		switch (aAddr) {
+			case CONIN_ADDR : case CONOUT_ADDR : case LIST_ADDR : case PUNCH_ADDR : case READER_ADDR : return 1;
+			default : return 0;
+		}
+	}
+
 /**
  * BDOS functions.
  * PC register contains the local address.
@@ -76,23 +128,31 @@ public:
 		assert(memory);
 		switch (state.Z_Z80_STATE_MEMBER_PC) {
 			case CONST_ADDR : {	// constf
-				char c;
-				const auto n = std::cin.readsome(&c, 1);
-				if (!n) {
-					state.Z_Z80_STATE_MEMBER_A = 0x00;
-				} else {
-					std::cin.putback(c);
-					state.Z_Z80_STATE_MEMBER_A = 0xFF;
-				}
+				state.Z_Z80_STATE_MEMBER_A = console.status() ? 0xFF : 0x00;
 				break;
 			}
 			case CONIN_ADDR : {	// coninf
-				const auto c = std::cin.get();
-				state.Z_Z80_STATE_MEMBER_A = (c & 0x0F);
+				state.Z_Z80_STATE_MEMBER_A = console.get() & 0x7F;
 				break;
 			}
 			case CONOUT_ADDR : {	// coninf
-				std::cout << char(state.Z_Z80_STATE_MEMBER_C);
+				console.put(state.Z_Z80_STATE_MEMBER_C);
+				break;
+			}
+			case LIST_ADDR : {
+				devices.list(memory[IOBYTE], state.Z_Z80_STATE_MEMBER_C);
+				break;
+			}
+			case PUNCH_ADDR : {
+				devices.punch(memory[IOBYTE], state.Z_Z80_STATE_MEMBER_C);
+				break;
+			}
+			case READER_ADDR : {
+				state.Z_Z80_STATE_MEMBER_A = devices.reader(memory[IOBYTE]);
+				break;
+			}
+			case LISTST_ADDR : {	// always ready
+				state.Z_Z80_STATE_MEMBER_A = 0xFF;
 				break;
 			}
 				
@@ -108,12 +168,26 @@ public:
 protected:
 
 private:
+/**
+ * Console & devices shared with the BDOS.
+ */
+	Console& console;
+	Devices& devices;
+
+/**
+ * IOBYTE address, routing the logical devices (see Devices).
+ */
+	static constexpr auto IOBYTE = 3U;
+
 	enum {
 		BOOT_ADDR 	= BIOS_ADDR + 3 * 0,
 		WBOOT_ADDR 	= BIOS_ADDR + 3 * 1,
 		CONST_ADDR 	= BIOS_ADDR + 3 * 2,
 		CONIN_ADDR 	= BIOS_ADDR + 3 * 3,
 		CONOUT_ADDR = BIOS_ADDR + 3 * 4,
-//		LIST_ADDR 	= BIOS_ADDR + 3 * 5
+		LIST_ADDR 	= BIOS_ADDR + 3 * 5,
+		PUNCH_ADDR 	= BIOS_ADDR + 3 * 6,
+		READER_ADDR = BIOS_ADDR + 3 * 7,
+		LISTST_ADDR = BIOS_ADDR + 3 * 15
 	};
 };
@@ -0,0 +1,218 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <csignal>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <atomic>
+#include <chrono>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CALLS_SIGNAL 1
+#endif
+
+/**
+ * Counters of the BDOS & BIOS functions: calls, bytes moved (console
+ * characters, records read or written...) and host time, with a latency
+ * histogram by power of 2 nanoseconds. The report is written at exit, and on
+ * SIGUSR1 while running; its summary splits the host time between the file
+ * functions, the console & the rest (devices, and the emulation itself).
+ */
+class Calls {
+public:
+	enum System { BDOS, BIOS };
+
+/**
+ * Latency buckets: bucket i counts the calls of 2^i to 2^(i+1)-1 ns, the last
+ * one the longer calls.
+ */
+	static constexpr unsigned BUCKETS = 36;
+
+/**
+ * Counters of a function.
+ */
+	struct Function {
+		const char* name;
+		uint64_t calls;
+		uint64_t bytes;
+		uint64_t nanoseconds;
+		uint64_t max;
+		uint64_t latency[BUCKETS];
+	};
+
+/**
+ * Count the calls.
+ * @param aPath Report file, truncated & written at exit and on SIGUSR1.
+ * @return false if the file can't be created.
+ */
+	static bool configure(const std::string& aPath) {
+		std::ofstream fs(aPath, std::ios::trunc);
+		if (!fs) {
+			std::cerr << ">> Error creating calls file \"" << aPath << "\"!" << std::endl;
+			return false;
+		}
+		settings().path = aPath;
+		return true;
+	}
+
+/**
+ * Start the configured counters, once.
+ */
+	static void start() {
+		auto& s = settings();
+		if (s.path.empty() || s.started) return;
+		s.started = true;
+		s.since = std::chrono::steady_clock::now();
+		functions();
+		std::atexit(write);
+#ifdef CALLS_SIGNAL
+		std::signal(SIGUSR1, onRequest);
+#endif
+	}
+
+/**
+ * @return true if the calls are counted.
+ */
+	static bool enabled() {
+		return settings().started;
+	}
+
+/**
+ * Count a call.
+ * @param aFunction BDOS function (C register) or BIOS entry (jump number).
+ * @param aName Name of the function (static), or NULL.
+ * @param aBytes Bytes moved.
+ * @param aNanoseconds Host time.
+ */
+	static void count(const System aSystem, const uint8_t aFunction, const char* aName, const uint64_t aBytes, const uint64_t aNanoseconds) {
+		auto& f = functions()[aSystem][aFunction];
+		f.name = aName;
+		++f.calls;
+		f.bytes += aBytes;
+		f.nanoseconds += aNanoseconds;
+		if (aNanoseconds > f.max) f.max = aNanoseconds;
+		unsigned i = 0;
+		while ((i < BUCKETS - 1) && (aNanoseconds >> (i + 1))) ++i;
+		++f.latency[i];
+	}
+
+/**
+ * @return true once after SIGUSR1.
+ */
+	static bool requested() {
+		return request().exchange(false);
+	}
+
+/**
+ * Write the report in the file.
+ */
+	static void write() {
+		std::ofstream fs(settings().path, std::ios::trunc);
+		report(fs);
+	}
+
+/**
+ * Write the counters of the functions called, and the host time summary.
+ */
+	static void report(std::ostream& aOut) {
+		const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - settings().since).count();
+		uint64_t file = 0, console = 0, other = 0;
+		char line[160];
+		snprintf(line, sizeof(line), "%-16s %10s %12s %11s %8s %8s", "Function", "calls", "bytes", "total ms", "mean us", "max us");
+		aOut << line << std::endl;
+		for (const auto s : { BDOS, BIOS }) {
+			for (unsigned i = 0; i < 256; ++i) {
+				const auto& f = functions()[s][i];
+				if (!f.calls) continue;
+				char name[32];
+				if (f.name) snprintf(name, sizeof(name), "%s:%s", (s == BDOS) ? "BDOS" : "BIOS", f.name);
+				else snprintf(name, sizeof(name), "%s:%u", (s == BDOS) ? "BDOS" : "BIOS", i);
+				snprintf(line, sizeof(line), "%-16s %10llu %12llu %11.3f %8.2f %8.2f", name,
+						 (unsigned long long)f.calls, (unsigned long long)f.bytes,
+						 f.nanoseconds / 1e6, f.nanoseconds / 1e3 / f.calls, f.max / 1e3);
+				aOut << line << std::endl;
+				aOut << "  latency:";
+				for (unsigned b = 0; b < BUCKETS; ++b) {
+					if (f.latency[b]) aOut << ' ' << duration(b) << ' ' << f.latency[b];
+				}
+				aOut << std::endl;
+
+				const std::string n = name + 5;
+				if (!n.compare(0, 2, "F_") || !n.compare(0, 4, "DRV_") || (n == "READ") || (n == "WRITE")) file += f.nanoseconds;
+				else if (!n.compare(0, 2, "C_") || !n.compare(0, 3, "CON")) console += f.nanoseconds;
+				else other += f.nanoseconds;
+			}
+		}
+		snprintf(line, sizeof(line), "Host time: %.3f s elapsed, files %.3f s, console %.3f s, other calls %.3f s, emulation & waits %.3f s",
+				 elapsed / 1e9, file / 1e9, console / 1e9, other / 1e9, (elapsed - int64_t(file + console + other)) / 1e9);
+		aOut << line << std::endl;
+	}
+
+protected:
+/**
+ * @return the lower bound of a latency bucket, e.g. ">=512ns", ">=1us".
+ */
+	static std::string duration(const unsigned aBucket) {
+		static const char* const UNITS[] = { "ns", "us", "ms", "s" };
+		const uint64_t ns = uint64_t(1) << aBucket;
+		uint64_t v = ns;
+		unsigned u = 0;
+		while ((v >= 1000) && (u < 3)) {
+			v /= 1000;
+			++u;
+		}
+		return ">=" + std::to_string(v) + UNITS[u];
+	}
+
+#ifdef CALLS_SIGNAL
+	static void onRequest(int) {
+		request() = true;
+	}
+#endif
+
+private:
+	struct Settings {
+		std::string path;
+		bool started = false;
+		std::chrono::steady_clock::time_point since;
+	};
+
+	static Settings& settings() {
+		static Settings s;
+		return s;
+	}
+
+/**
+ * Counters by system & function.
+ */
+	typedef Function Functions[2][256];
+
+	static Functions& functions() {
+		static Functions f = {};
+		return f;
+	}
+
+	static std::atomic<bool>& request() {
+		static std::atomic<bool> r(false);
+		return r;
+	}
+};
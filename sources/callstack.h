@@ -0,0 +1,208 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/**
+ * Shadow call stack of a machine, for flame graphs: the cycles of each
+ * instruction are counted in the stack of the calls (CALL, RST) running it,
+ * and the stacks are written at exit as "collapsed stacks" (one line by
+ * stack: the frames separated by ';', then the cycles), read by flamegraph.pl,
+ * speedscope or inferno.
+ * A frame is popped when the stack pointer goes above the return address it
+ * pushed: by a RET, but also when the return address is popped to return by a
+ * JP (HL), or when the stack is reset.
+ * The stacks of all the machines are merged into a tree of frames, named by
+ * the machine when they are created (symbols, BDOS functions...).
+ */
+class CallStack {
+public:
+/**
+ * Deepest stack followed, the deeper calls are counted in it.
+ */
+	static constexpr unsigned MAX_DEPTH = 256;
+
+/**
+ * Clock of the emulated CPU (4 MHz), converting the host time of the BDOS &
+ * BIOS functions into cycles.
+ */
+	static constexpr uint64_t CLOCK = 4000000;
+
+/**
+ * Name of a frame, from its key (see push).
+ */
+	typedef std::string (*Namer)(uint32_t aKey);
+
+/**
+ * Follow the calls.
+ * @param aPath Collapsed stacks file, truncated & written at exit.
+ * @return false if the file can't be created.
+ */
+	static bool configure(const std::string& aPath) {
+		std::ofstream fs(aPath, std::ios::trunc);
+		if (!fs) {
+			std::cerr << ">> Error creating flame graph file \"" << aPath << "\"!" << std::endl;
+			return false;
+		}
+		settings() = aPath;
+		return true;
+	}
+
+/**
+ * @param aNamer Names of the frames of the machine.
+ * @return a call stack for a machine if configured, or NULL.
+ */
+	static CallStack* create(const Namer aNamer) {
+		if (settings().empty()) return NULL;
+		static bool registered = false;
+		if (!registered) {
+			registered = true;
+			tree();
+			std::atexit(write);
+		}
+		return new CallStack(aNamer);
+	}
+
+	CallStack(const CallStack&) = delete;
+	CallStack& operator=(const CallStack&) = delete;
+
+/**
+ * A run starts: the stack is emptied, the root frame is the start address.
+ */
+	void start(const uint16_t aAddr) {
+		frames.clear();
+		current = child(0, aAddr);
+	}
+
+/**
+ * Count cycles in the current stack.
+ */
+	void count(const uint64_t aCycles) {
+		tree()[current].cycles += aCycles;
+	}
+
+/**
+ * A call is done.
+ * @param aKey Called address, with the BDOS function in bits 16 & up (see
+ *        Namer).
+ * @param aSP Stack pointer, on the return address.
+ */
+	void push(const uint32_t aKey, const uint16_t aSP) {
+		if (frames.size() >= MAX_DEPTH) return;
+		frames.push_back(Frame { current, aSP });
+		current = child(current, aKey);
+	}
+
+/**
+ * The stack pointer went up: pop the frames whose return address is gone.
+ */
+	void unwind(const uint16_t aSP) {
+		while (!frames.empty() && (aSP > frames.back().sp)) {
+			current = frames.back().caller;
+			frames.pop_back();
+		}
+	}
+
+/**
+ * @return the stack pointer of the innermost frame, or 0xFFFF without any.
+ */
+	uint16_t top() const {
+		return frames.empty() ? 0xFFFF : frames.back().sp;
+	}
+
+protected:
+	explicit CallStack(const Namer aNamer) :
+		namer(aNamer) {
+	}
+
+	struct Node {
+		uint32_t parent;
+		std::string name;
+		uint64_t cycles;
+	};
+
+	struct Frame {
+		uint32_t caller;
+		uint16_t sp;
+	};
+
+/**
+ * @return the node called by a node, created if new.
+ */
+	uint32_t child(const uint32_t aParent, const uint32_t aKey) {
+		auto& t = tree();
+		const uint64_t id = (uint64_t(aParent) << 32) | aKey;
+		auto& c = children()[id];
+		if (!c) {
+			c = t.size();
+			t.push_back(Node { aParent, namer(aKey), 0 });
+		}
+		return c;
+	}
+
+/**
+ * Write the collapsed stacks.
+ */
+	static void write() {
+		std::ofstream fs(settings(), std::ios::trunc);
+		const auto& t = tree();
+		std::vector<const std::string*> path;
+		for (size_t i = 1; i < t.size(); ++i) {
+			if (!t[i].cycles) continue;
+			path.clear();
+			for (auto n = i; n; n = t[n].parent) path.push_back(&t[n].name);
+			for (auto p = path.rbegin(); p != path.rend(); ++p) {
+				if (p != path.rbegin()) fs << ';';
+				fs << **p;
+			}
+			fs << ' ' << t[i].cycles << '\n';
+		}
+	}
+
+private:
+	static std::string& settings() {
+		static std::string path;
+		return path;
+	}
+
+/**
+ * Frames of all the machines, the first being the root of the runs.
+ */
+	static std::vector<Node>& tree() {
+		static std::vector<Node> t { Node { 0, std::string(), 0 } };
+		return t;
+	}
+
+/**
+ * Nodes by caller node & key.
+ */
+	static std::unordered_map<uint64_t, uint32_t>& children() {
+		static std::unordered_map<uint64_t, uint32_t> c;
+		return c;
+	}
+
+	const Namer namer;
+	std::vector<Frame> frames;
+	uint32_t current = 0;
+};
@@ -23,10 +23,21 @@
 #include <string>
 #include <fstream>
 #include <exception>
+#include <chrono>
 
 #include "Z80.h"
 #include "bdos.h"
 #include "bios.h"
+#include "task.h"
+#include "trace.h"
+#include "disassembler.h"
+#include "symbols.h"
+#include "profile.h"
+#include "callstack.h"
+#include "calls.h"
+#include "opcodes.h"
+#include "heatmap.h"
+#include "metrics.h"
 
 #define S(x) #x
 #define S_(x) S(x)
@@ -108,7 +119,11 @@
  
 #define UNUSED __attribute__ ((unused))
  
-template <unsigned MEMORY_SIZE, uint16_t BDOS_ADDR, uint16_t BIOS_ADDR>
+/**
+ * OPCODES: the instructions executed are counted in the opcode mix (see
+ * OpcodeMix), otherwise the run loop has no code for it.
+ */
+template <unsigned MEMORY_SIZE, uint16_t BDOS_ADDR, uint16_t BIOS_ADDR, bool OPCODES = false>
 class Computer {
 public:
 /**
@@ -117,25 +132,59 @@ public:
 	Computer() : 
 		cpu(),
 		memory(),
-		bdos(),
-		bios() {
+		console(),
+		devices(console),
+		bdos(console, devices),
+		bios(console, devices),
+		trace(Trace::create()),
+		stack(CallStack::create(frame)),
+		heat(HeatMap::create(BDOS_ADDR)) {
+		if (Metrics::enabled()) Metrics::attach(&metrics, refresh, this);
+
+		banner(std::cout);
+		power();
+	};
+
+/**
+ * Constructor of a session, with its console on a connection (no banner).
+ * @param aIn Input descriptor, or -1 for none.
+ * @param aOut Output descriptor.
+ * @param aSource Input typed by the connection.
+ */
+	Computer(const int aIn, const int aOut, ConsoleInput *const aSource) :
+		cpu(),
+		memory(),
+		console(aIn, aOut, aSource, true),
+		devices(console),
+		bdos(console, devices),
+		bios(console, devices),
+		trace(NULL),
+		stack(CallStack::create(frame)),
+		heat(HeatMap::create(BDOS_ADDR)) {
+		if (Metrics::enabled()) Metrics::attach(&metrics, refresh, this);
+
+		power();
+	}
+
+	~Computer() {
+		if (Metrics::enabled()) Metrics::detach(&metrics);
+		Profile::forget(&profiled);
+		delete trace;
+		delete stack;
+	}
 
+/**
+ * Print out somme copyright texts.
+ */
+	static void banner(std::ostream& aOut) {
+		BIOS<MEMORY_SIZE, BIOS_ADDR>::banner(aOut);
 /// Copyright © 1999-2018 Manuel Sainz de Baranda y Goñi."
-		std::cout << "Zilog Z80 CPU Emulator" << std::endl;
-		std::cout << "Copyright (c) 1999-2018 Manuel Sainz de Baranda y Goni." << std::endl;
-		std::cout << "Released under the terms of the GNU General Public License v3." << std::endl;
-		std::cout << std::endl;
+		aOut << "Zilog Z80 CPU Emulator" << std::endl;
+		aOut << "Copyright (c) 1999-2018 Manuel Sainz de Baranda y Goni." << std::endl;
+		aOut << "Released under the terms of the GNU General Public License v3." << std::endl;
+		aOut << std::endl;
+	}
 
-		cpu.context = this;
-		cpu.read = Computer::read;
-		cpu.write = Computer::write;
-		cpu.in = Computer::in;
-		cpu.out = Computer::out;
-		cpu.int_data = NULL;
-		cpu.halt = NULL;
-		z80_power(&cpu, true);
-	};
-	
 /**
  * Initialize cpu and BDOS ; optionaly load program (CPP) at designed address.
  * @param aFilename Path to binary to load in memory.
@@ -187,56 +236,69 @@ public:
 		}
 	}
 	
-	void run(const uint16_t aAddr=0x0100) {
+/**
+ * What a suspended run waits for.
+ */
+	enum class Wait { NONE, INPUT, SLICE };
+
+/**
+ * Start a run, to be resumed by a scheduler: it is suspended when the console
+ * input is awaited, and every POLL_PERIOD instructions to share the thread.
+ * @param aAddr Start address.
+ * @return the suspended run, over at a reset or a warm boot.
+ */
+	Task start(const uint16_t aAddr=0x0100) {
 		assert(aAddr);	// > 0
 		cpu.state.Z_Z80_STATE_MEMBER_PC = aAddr;
+		Profile::running(&profiled);
+		if (stack) stack->start(aAddr);
+		if constexpr (OPCODES) history = {};
 		while (true) {
-			if (cpu.state.Z_Z80_STATE_MEMBER_PC >= MEMORY_SIZE * 1024) {
+			const uint16_t pc = cpu.state.Z_Z80_STATE_MEMBER_PC;
+			if (pc >= MEMORY_SIZE * 1024) {
 				constexpr char EXECUTING_OUT_OF_MEMORY[] = "Executing out of memory!";
 				std::cerr << ">> " << EXECUTING_OUT_OF_MEMORY << std::endl;
 				throw std::runtime_error(EXECUTING_OUT_OF_MEMORY);
 			}
-			
-			if (cpu.state.Z_Z80_STATE_MEMBER_PC == 0x0000) {	// Reset
-#ifdef LOG
-				logSpecAddr(cpu.state);
-#endif
-				return;
-			} 
-			
-			if (cpu.state.Z_Z80_STATE_MEMBER_PC == 0x0003) {	// Warm boot
-#ifdef LOG
-				logSpecAddr(cpu.state);
-#endif
-				return;
-			} 
-			
-			if (cpu.state.Z_Z80_STATE_MEMBER_PC == 0x0005) {	// BDOS
-#ifdef LOG
-				logSpecAddr(cpu.state);
-#endif
-				bdos.function(cpu.state, memory);
-			// Return
-				cpu.state.Z_Z80_STATE_MEMBER_PC = memory[cpu.state.Z_Z80_STATE_MEMBER_SP++];
-				cpu.state.Z_Z80_STATE_MEMBER_PC += memory[cpu.state.Z_Z80_STATE_MEMBER_SP++] * 256U;
-				continue;
-			}
 
-			if (cpu.state.Z_Z80_STATE_MEMBER_PC >= BIOS_ADDR) {	// BIOS
-#ifdef LOG
-				logSpecAddr(cpu.state);
-#endif
-				bios.function(cpu.state, memory);
-			// Return
-				cpu.state.Z_Z80_STATE_MEMBER_PC = memory[cpu.state.Z_Z80_STATE_MEMBER_SP++];
-				cpu.state.Z_Z80_STATE_MEMBER_PC += memory[cpu.state.Z_Z80_STATE_MEMBER_SP++] * 256U;
-				continue;
+			if (traps[pc >> 3] & (1 << (pc & 0x07))) {
+				if ((pc == 0x0000) || (pc == 0x0003)) {	// Reset or warm boot
+					if (trace) record();
+					co_return;
+				}
+
+				if (pc == 0x0005) {	// BDOS
+					if (trace) record();
+					while (!bdos.ready(cpu.state, memory)) co_await suspend(Wait::INPUT);
+					waiting = Wait::NONE;
+					const uint8_t function = cpu.state.Z_Z80_STATE_MEMBER_C;
+					if (stack || Calls::enabled()) bdosFunction();
+					else bdos.function(cpu.state, memory);
+					count(function);
+				// Return
+					cpu.state.Z_Z80_STATE_MEMBER_PC = memory[cpu.state.Z_Z80_STATE_MEMBER_SP++];
+					cpu.state.Z_Z80_STATE_MEMBER_PC += memory[cpu.state.Z_Z80_STATE_MEMBER_SP++] * 256U;
+					if (stack) stack->unwind(cpu.state.Z_Z80_STATE_MEMBER_SP);
+					continue;
+				}
+
+				if (pc >= BIOS_ADDR) {	// BIOS
+					if (trace) record();
+					while (!bios.ready(cpu.state, memory)) co_await suspend(Wait::INPUT);
+					waiting = Wait::NONE;
+					if (stack || Calls::enabled()) biosFunction();
+					else bios.function(cpu.state, memory);
+				// Return
+					cpu.state.Z_Z80_STATE_MEMBER_PC = memory[cpu.state.Z_Z80_STATE_MEMBER_SP++];
+					cpu.state.Z_Z80_STATE_MEMBER_PC += memory[cpu.state.Z_Z80_STATE_MEMBER_SP++] * 256U;
+					if (stack) stack->unwind(cpu.state.Z_Z80_STATE_MEMBER_SP);
+					continue;
+				}
+
+				logSpecAddr(std::clog, pc, cpu.state.Z_Z80_STATE_MEMBER_C);		// symbol, when logging
 			}
 
-#ifdef LOG
-			logSpecAddr(cpu.state);
-			logInst(cpu.state);
-#endif
+			if (trace) record();
 			if (memory[cpu.state.Z_Z80_STATE_MEMBER_PC] == 0x76)  {		// HALT
 				constexpr char HALT_INSTRUCTION[] = "HALT instruction";
 				std::cerr << ">> "<< HALT_INSTRUCTION << " at "
@@ -244,10 +306,118 @@ public:
 						  << cpu.state.Z_Z80_STATE_MEMBER_PC << "!" << std::endl;
 				throw std::runtime_error(HALT_INSTRUCTION);
 			}
-			z80_run(&cpu, 1);	// return cycles
+			if constexpr (OPCODES) {
+				if (OpcodeMix::enabled()) OpcodeMix::count(pc, memory, sizeof(memory), history);
+			}
+			if (instrumented) step(pc);
+			else cycles += z80_run(&cpu, 1);
+			if (cycles >= sampling) {
+				Profile::sample(cpu.state.Z_Z80_STATE_MEMBER_PC, memory, sizeof(memory));
+				sampling += Profile::period();
+			}
+			if (!(++ticks % POLL_PERIOD)) {
+				console.poll();
+				if (trace && Trace::requested()) trace->dump();
+				if (Metrics::due()) Metrics::write();
+				co_await suspend(Wait::SLICE);
+				waiting = Wait::NONE;
+			}
 		}
 	}
 
+/**
+ * Run on the calling thread, blocking while the console input is awaited.
+ * @param aAddr Start address.
+ */
+	void run(const uint16_t aAddr=0x0100) {
+		auto task = start(aAddr);
+		try {
+			while (task.resume()) {
+				if (trace && Trace::requested()) trace->dump();
+				if (Calls::requested()) Calls::write();
+				if (waiting == Wait::INPUT) console.wait();
+			}
+		} catch (Console::Closed&) {
+			throw;
+		} catch (...) {
+			if (trace) trace->dump();		// stopped on an error
+			throw;
+		}
+	}
+
+/**
+ * Decode a trace into the text log: address, opcode bytes, instruction,
+ * registers and symbol ("name+offset"), one line by instruction.
+ * @param aEntries Trace entries (see Trace::load).
+ * @param aOut Text log.
+ */
+	static void decode(const std::vector<Trace::Entry>& aEntries, std::ostream& aOut) {
+		static constexpr char HEX[] = "0123456789abcdef";
+		for (const auto& e : aEntries) {
+			logSpecAddr(aOut, e.pc, uint8_t(e.bc));
+			if (e.pc == 0x0005) {
+				aOut << std::endl;
+				continue;
+			}
+			char line[192];
+			char* p = line;
+			const auto hex = [&p](const unsigned aValue, const unsigned aDigits) {
+				for (auto i = aDigits; i--; ) *p++ = HEX[(aValue >> (4 * i)) & 0x0F];
+			};
+			hex(e.pc, 4);
+			*p++ = '\t';
+			char text[Disassembler::TEXT_SIZE];
+			const auto length = Disassembler::disassemble(e.code, e.pc, text, sizeof(text));
+			for (unsigned i = 0; i < length; ++i) {
+				if (i) *p++ = ' ';
+				hex(e.code[i], 2);
+			}
+			*p++ = '\t';
+			if (length < 3) *p++ = '\t';
+			const auto mnemonic = p;
+			for (auto t = text; *t; ++t) *p++ = *t;
+			do *p++ = ' '; while (p < mnemonic + Disassembler::TEXT_SIZE);
+			const struct { char name[4]; uint16_t value; } registers[] = {
+				{ "AF=", e.af }, { "BC=", e.bc }, { "DE=", e.de }, { "HL=", e.hl }, { "IX=", e.ix }, { "IY=", e.iy }, { "SP=", e.sp }
+			};
+			for (const auto& r : registers) {
+				for (auto n = r.name; *n; ++n) *p++ = *n;
+				hex(r.value, 4);
+				*p++ = ' ';
+			}
+			if (Symbols::locate(e.pc, p + 2, line + sizeof(line) - p - 2)) {
+				p[0] = ';';
+				p[1] = ' ';
+				p += strlen(p);
+			} else {
+				--p;
+			}
+			*p++ = '\n';
+			aOut.write(line, p - line);
+		}
+	}
+
+/**
+ * @return what the suspended run waits for.
+ */
+	Wait waits() const {
+		return waiting;
+	}
+
+/**
+ * Emulate a terminal on the console (see Terminal).
+ */
+	void emulate(const Terminal::Type aType) {
+		console.emulate(aType);
+	}
+
+/**
+ * Write out the pending console output.
+ */
+	void flush() {
+		console.flush();
+	}
+
 /**
  * BIAS value is more or less the last free address for programs.
  */
@@ -255,6 +425,193 @@ public:
 	
 protected:
 	
+/**
+ * Record the instruction to execute in the trace.
+ */
+	void record() {
+		auto& e = trace->slot();
+		const auto& s = cpu.state;
+		e.pc = s.Z_Z80_STATE_MEMBER_PC;
+		for (unsigned i = 0; i < sizeof(e.code); ++i) e.code[i] = memory[(e.pc + i) % (MEMORY_SIZE * 1024)];
+		e.af = s.Z_Z80_STATE_MEMBER_AF;
+		e.bc = s.Z_Z80_STATE_MEMBER_BC;
+		e.de = s.Z_Z80_STATE_MEMBER_DE;
+		e.hl = s.Z_Z80_STATE_MEMBER_HL;
+		e.ix = s.Z_Z80_STATE_MEMBER_IX;
+		e.iy = s.Z_Z80_STATE_MEMBER_IY;
+		e.sp = s.Z_Z80_STATE_MEMBER_SP;
+		e.cycles = cycles;
+		trace->commit();
+	}
+
+/**
+ * Count a BDOS call in the metrics, and the record it read or wrote.
+ */
+	void count(const uint8_t aFunction) {
+		++metrics.bdos[aFunction];
+		if (cpu.state.Z_Z80_STATE_MEMBER_A) return;
+		switch (aFunction) {
+			case 0x14 : case 0x21 : metrics.fileRead += 128; break;
+			case 0x15 : case 0x22 : case 0x28 : metrics.fileWritten += 128; break;
+			default : break;
+		}
+	}
+
+/**
+ * Copy the counters of a machine into its metrics (see Metrics::attach).
+ */
+	static void refresh(void* aComputer) {
+		static_cast<Computer*>(aComputer)->refresh();
+	}
+
+	void refresh() {
+		metrics.name = BDos<MEMORY_SIZE, BDOS_ADDR>::name;
+		metrics.waiting = (waiting == Wait::INPUT);
+		metrics.instructions = ticks;
+		metrics.cycles = cycles;
+		metrics.consoleIn = console.bytesRead();
+		metrics.consoleOut = console.bytesWritten();
+		metrics.files = bdos.files();
+	}
+
+/**
+ * Execute an instruction, followed by the call stack and counted in the heat
+ * map.
+ */
+	void step(const uint16_t aPC) {
+		if (heat) ++heat->counts[HeatMap::EXECUTE][aPC];
+		const uint8_t opcode = memory[aPC];
+		const uint16_t sp = cpu.state.Z_Z80_STATE_MEMBER_SP;
+		const auto n = z80_run(&cpu, 1);
+		cycles += n;
+		if (stack) follow(opcode, sp, n);
+	}
+
+/**
+ * Follow the calls & returns of an instruction executed in the call stack,
+ * and count its cycles in it.
+ * @param aOpcode First byte of the instruction.
+ * @param aSP Stack pointer before the instruction.
+ */
+	void follow(const uint8_t aOpcode, const uint16_t aSP, const unsigned aCycles) {
+		const uint16_t sp = cpu.state.Z_Z80_STATE_MEMBER_SP;
+		stack->count(aCycles);
+		if ((sp == uint16_t(aSP - 2)) && ((aOpcode == 0xCD) || ((aOpcode & 0xC7) == 0xC4) || ((aOpcode & 0xC7) == 0xC7))) {	// CALL, CALL cc, RST taken
+			const uint16_t pc = cpu.state.Z_Z80_STATE_MEMBER_PC;
+			stack->push((pc == 0x0005) ? pc | ((cpu.state.Z_Z80_STATE_MEMBER_C + 1U) << 16) : pc, sp);
+		} else if (sp > stack->top()) {		// RET, RETI, RETN, or the return address popped (POP & JP (HL))
+			stack->unwind(sp);
+		}
+	}
+
+/**
+ * Run the BDOS function of the C register, measured: its host time is counted
+ * in the call stack as cycles of the emulated CPU, and in the calls counters.
+ */
+	void bdosFunction() {
+		const uint8_t function = cpu.state.Z_Z80_STATE_MEMBER_C;
+		const uint16_t de = cpu.state.Z_Z80_STATE_MEMBER_DE;
+		const auto ns = measure([this] { bdos.function(cpu.state, memory); });
+		if (stack) stack->count(ns * CallStack::CLOCK / 1000000000U);
+		if (Calls::enabled()) {
+			Calls::count(Calls::BDOS, function, BDos<MEMORY_SIZE, BDOS_ADDR>::name(function),
+						 BDos<MEMORY_SIZE, BDOS_ADDR>::transferred(function, de, cpu.state, memory), ns);
+		}
+	}
+
+/**
+ * Run the BIOS function of the PC, measured as bdosFunction().
+ */
+	void biosFunction() {
+		const uint16_t pc = cpu.state.Z_Z80_STATE_MEMBER_PC;
+		const auto ns = measure([this] { bios.function(cpu.state, memory); });
+		if (stack) stack->count(ns * CallStack::CLOCK / 1000000000U);
+		if (Calls::enabled()) {
+			Calls::count(Calls::BIOS, uint8_t((pc - BIOS_ADDR) / 3), BIOS<MEMORY_SIZE, BIOS_ADDR>::name(pc),
+						 BIOS<MEMORY_SIZE, BIOS_ADDR>::transferred(pc), ns);
+		}
+	}
+
+/**
+ * @return the host time of a function, in nanoseconds.
+ */
+	template <typename F>
+	static uint64_t measure(const F& aFunction) {
+		const auto begin = std::chrono::steady_clock::now();
+		aFunction();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+	}
+
+/**
+ * Name of a frame of the call stack: BDOS function (key with the C register
+ * + 1 in bits 16 & up), BIOS entry, symbol, or address.
+ */
+	static std::string frame(const uint32_t aKey) {
+		char text[64];
+		if (aKey >> 16) {
+			const auto name = BDos<MEMORY_SIZE, BDOS_ADDR>::name((aKey >> 16) - 1);
+			if (name) snprintf(text, sizeof(text), "BDOS:%s", name);
+			else snprintf(text, sizeof(text), "BDOS:%u", (aKey >> 16) - 1);
+		} else if (const auto name = BIOS<MEMORY_SIZE, BIOS_ADDR>::name(aKey)) {
+			snprintf(text, sizeof(text), "BIOS:%s", name);
+		} else if (!Symbols::locate(aKey, text, sizeof(text))) {
+			snprintf(text, sizeof(text), "%04Xh", aKey);
+		}
+		return text;
+	}
+
+/**
+ * Suspension of the run: the profiler timer samples the machine again when
+ * it is resumed.
+ */
+	struct Suspension : std::suspend_always {
+		const Profile::Target* profiled;
+
+		void await_resume() const noexcept {
+			Profile::running(profiled);
+		}
+	};
+
+/**
+ * Suspend the run.
+ */
+	Suspension suspend(const Wait aWait) {
+		const bool idle = (aWait == Wait::INPUT) && (waiting != Wait::INPUT);	// not a line being typed
+		waiting = aWait;
+		Profile::running(NULL);
+		if (idle && Metrics::enabled()) Metrics::idle(&metrics);
+		return Suspension { {}, &profiled };
+	}
+
+/**
+ * Power on the CPU, with the memory callbacks.
+ */
+	void power() {
+		cpu.context = this;
+		cpu.read = heat ? Computer::readCounted : Computer::read;
+		cpu.write = heat ? Computer::writeCounted : Computer::write;
+		cpu.in = Computer::in;
+		cpu.out = Computer::out;
+		cpu.int_data = NULL;
+		cpu.halt = NULL;
+		z80_power(&cpu, true);
+
+		trap(0x0000);
+		trap(0x0003);
+		trap(0x0005);
+		for (unsigned addr = BIOS_ADDR; addr < MEMORY_SIZE * 1024; ++addr) trap(addr);
+		if (Log::enabled()) {
+			for (const auto& s : Symbols::all()) trap(s.addr);
+		}
+	}
+
+/**
+ * Stop the run loop at an address.
+ */
+	void trap(const uint16_t aAddr) {
+		traps[aAddr >> 3] |= 1 << (aAddr & 0x07);
+	}
+	
 /**
  * Reset computer set all low-memory values & lauche warm boot
  */
@@ -292,6 +649,21 @@ protected:
 		c->memory[address] = value;
 	}
 
+/**
+ * Memory callbacks counting the accesses in the heat map.
+ */
+	static zuint8 readCounted(void* context, zuint16 address) {
+		const auto c = static_cast<Computer *const>(context);
+		++c->heat->counts[HeatMap::READ][address];
+		return c->memory[address];
+	}
+
+	static void writeCounted(void* context, zuint16 address, zuint8 value) {
+		auto c = static_cast<Computer *const>(context);
+		++c->heat->counts[HeatMap::WRITE][address];
+		c->memory[address] = value;
+	}
+
 /**
  * Callback used by Z80 to read from ports.
  * @param context Pointer on Computer's instance.
@@ -323,874 +695,25 @@ protected:
 	}
 
 /**
- * Add a comment for special addr found in CCP source code.
- * @param CPU state.
+ * Add a comment for the CP/M entry points & the symbols.
+ * @param aOut Log.
+ * @param aAddr Address executed.
+ * @param aFunction BDOS function (register C).
  */
-	void logSpecAddr(const ZZ80State& state) const {
-		const uint16_t addr = state.Z_Z80_STATE_MEMBER_PC;
-		switch (addr) {
-			case 0x0000 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; R E S E T   !" << std::endl; break;
-			case 0x0003 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; W A R M   B O O T  !" << std::endl; break;
-			case 0x0005 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; BDOS function #" << std::dec << int(state.Z_Z80_STATE_MEMBER_C) << " - "; break;
-			case 0x0100 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; S T A R T   T H E   P R O G R A M --------------------------------------" << std::endl; break;
-
-// Pour CCP
-			case 0xDC8C : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Routine Print" << std::endl; break;
-//			case 0xDC92 : std::clog << "; Routine Print / save BC" << std::endl; break;
-//			case 0xDC98 : std::clog << "; Routine Print CR/LF" << std::endl; break;
-//			case 0xDCA2 : std::clog << "; Routine Print Space" << std::endl; break;
-//			case 0xDCA7 : std::clog << "; Routine Print Line" << std::endl; break;
-			case 0xDCB8 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Routine Reset disk" << std::endl; break;
-			case 0xDCBD : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Routine Select disk" << std::endl; break;
-			case 0xDCC3 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Routine Call bdos & save return" << std::endl; break;
-			case 0xDCCB : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Routine Open file (DE) point FCB" << std::endl; break;
-			case 0xDDA7 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Convert input line to upper case." << std::endl; break;
-			case 0xDE09 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Print back file name with a '?' to indicate a syntax error." << std::endl; break;
-//			case 0xDE30 : std::clog << "; Check character at (DE) for legal command input. Note that the zero flag is set if the character is a delimiter." << std::endl; break;
-			case 0xDE4F : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Get the next non-blank character from (DE)." << std::endl; break;
-			case 0xDE5E : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Convert the first name in (FCB)." << std::endl; break;
-			case 0xDE96 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Convert the basic file name." << std::endl; break;
-			case 0xDEC0 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Get the extension and convert it." << std::endl; break;
-			case 0xDEFE : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Check to see if this is an ambigeous file name specification." << std::endl; break;
-			case 0xDF2E : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; Search the command table for a match with what has just been entered." << std::endl; break;
-			case 0xDF5C : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; C C P  -   C o n s o l e   C o m m a n d   P r o c e s s o r" << std::endl; break;
-/*			case 0xdfc0 : 
-				for (unsigned i = 0xDFC1; i <= 0xDFCF; ++i) {
-					std::clog << std::hex << std::setw(2) << int(memory[i])<< " ";
-				}
-				std::clog << std::endl;
-				break;
-*/
-			case 0xE054 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ;  Check drive specified. If it means a change, then the new drive will be selected. In any case, the drive byte of the fcb will be set to null (means use current drive)." << std::endl; break;
-			case 0xE066 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ;  Check the drive selection and reset it to the previous drive if it was changed for the preceeding command." << std::endl; break;
-			case 0xE077 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; D I R E C T O R Y   C O M M A N D" << std::endl; break;
-			case 0xE210 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; R E N A M E   C O M M A N D" << std::endl; break;
-			case 0xE28E : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; U S E R   C O M M A N D" << std::endl; break;
-			case 0xE2A5 : std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << " ; T R A N S I A N T   P R O G R A M   C O M M A N D" << std::endl; break;
-
-// Pour zexdoc.com
-			case 0x1dce : std::clog << "; PUSHs, call BDOS, POPs" << std::endl; break;
-//			case 0x012f : std::clog << "; DONE !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!" << std::endl; exit(0); break;
-			case 0x1ae2 : std::clog << "; stt: Start Test pointed by (HL)" << std::endl; break;
-			case 0x1c38 : std::clog << "; clrmem: clear memory at hl, bc bytes" << std::endl; break;
-			case 0x1c49 : std::clog << "; initmask: initialise counter or shifter (DE & HL)" << std::endl; break;
-
-
-// Pour MBASIC
-			case 0x5d8c	: std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << "; INIT: (INIT.MAC)" << std::endl; break;
-			case 0x5dd8	: std::clog << std::hex << std::setw(4) << std::setfill('0') << addr << "; Check CP/M version number (INIT.MAC)" << std::endl; break;
-
-		}
-	}
-	
-	void logInst(const ZZ80State& state) const {
-		const uint16_t PC = state.Z_Z80_STATE_MEMBER_PC;
-		const uint8_t inst = memory[PC];
-		
-		switch (inst) {
-			case 0x00 : {	// NOP
-				logAddrInst(PC, inst);
-				std::clog << "NOP " << std::endl;
-				break;
-			}
-
-			case 0x01 : 
-			case 0x11 : 
-			case 0x21 : 
-			case 0x31 : {	// LD dd,nn
-				const uint16_t nn = memory[PC+2] * 256U + memory[PC+1];
-				logAddrInst(PC, inst, memory[PC+1], memory[PC+2]);
-				std::clog << "LD " << ddName(inst >> 4) << ','
-						  << std::setw(4) << std::hex << unsigned(nn) << "h \t; " 
-						  << std::dec << unsigned(nn) << std::endl;
-				break;
-			}
-
-			case 0x02 : 
-			case 0x12 : {	// LD (rr),A
-				logAddrInst(PC, inst);
-				std::clog << "LD (" << ddName(inst >> 4) << "),A" << std::endl;
-				break;
-			}
-
-			case 0x03 :
-			case 0x13 : 
-			case 0x23 : 
-			case 0x33 : {	// INC ss
-				logAddrInst(PC, inst);
-				std::clog << "INC " << ddName(inst >> 4) << std::endl;
-				break;
-			}
-
-			case 0x04 :
-			case 0x0C :
-			case 0x14 :
-			case 0x1C :
-			case 0x24 :
-			case 0x2C :
-			case 0x34 :
-			case 0x3C : {	// INC r
-				logAddrInst(PC, inst);
-				std::clog << "INC " << rName(inst >> 3) << std::endl;
-				break;
-			}
-	
-			case 0x05 :
-			case 0x0D :
-			case 0x15 :
-			case 0x1D :
-			case 0x25 :
-			case 0x2D :
-			case 0x35 :
-			case 0x3D : {	// DEC r
-				logAddrInst(PC, inst);
-				std::clog << "DEC " << rName(inst >> 3) << std::endl;
-				break;
-			}
-
-			case 0x06 : 
-			case 0x0E : 
-			case 0x16 : 
-			case 0x1E : 
-			case 0x26 : 
-			case 0x2E : 
-			case 0x36 : 
-			case 0x3E : {	// LD r,n
-				const uint8_t v = memory[PC+1];
-				logAddrInst(PC, inst, v);
-				std::clog << "LD " << rName(inst >> 3) << ',' << std::dec << unsigned(v);
-				if ((v >= ' ') && (v < 127)) std::clog << " \t; '" << char(v) << "'";
-				std::clog << std::endl;
-	  			break;
-			}
-
-			case 0x07 : {	// RLCA
-				logAddrInst(PC, inst);
-				std::clog << "RLCA" << std::endl;
-				break;
-			}
-			
-			case 0x09 :
-			case 0x19 :
-			case 0x29 :
-			case 0x39 : {	// ADD HL,ss
-				logAddrInst(PC, inst);
-				std::clog << "ADD HL," << ddName(inst >> 4) << std::endl;
-				break;
-			}
-
-			case 0x0A :
-			case 0x1A : {	// LD A,(dd)
-				logAddrInst(PC, inst);
-				std::clog << "LD A,(" << ddName(inst >> 4) << ")" << std::endl;
-				break;
-			}
-
-			case 0x0B :
-			case 0x1B : 
-			case 0x2B : 
-			case 0x3B : {	// DEC ss
-				logAddrInst(PC, inst);
-				std::clog << "DEC " << ddName(inst >> 4) << std::endl;
-				break;
-			}
-
-			case 0x0F : { 	// RRCA
-				logAddrInst(PC, inst);
-				std::clog << "RRCA" << std::endl;
-				break;
-			}
-	
-			case 0x10 : {	// DJNZ *
-				logAddrInst(PC, inst, memory[PC+1]);
-				std::clog << "DJNZ " << (memory[PC+1] > 127 ? "-" : "+")
-						  << (memory[PC+1] > 127 ? 256 - memory[PC+1] : memory[PC+1])
-						  << " \t\t; " << std::hex 
-						  << PC + (memory[PC+1] > 127 ? memory[PC+1] - 256 : memory[PC+1]) + 2
-						  << "h" << std::endl;
-				break;
-			}
-
-			case 0x17 : { 	// RLA
-				logAddrInst(PC, inst);
-				std::clog << "RLA" << std::endl;
-				break;
-			}
-			
-			case 0x18 : {	// JR *
-				logAddrInst(PC, inst, memory[PC+1]);
-				std::clog << "JR " << (memory[PC+1] > 127 ? "-" : "+")
-						  << (memory[PC+1] > 127 ? 256 - memory[PC+1] : memory[PC+1])
-						  << " \t\t; " << std::hex 
-						  << PC + (memory[PC+1] > 127 ? memory[PC+1] - 256 : memory[PC+1]) + 2
-						  << "h" << std::endl;
-				break;
-			}
-
-			case 0x1F : { 	// RRA
-				logAddrInst(PC, inst);
-				std::clog << "RRA" << std::endl;
-				break;
-			}
-			
-			case 0x20 :
-			case 0x28 :
-			case 0x30 :
-			case 0x38 : {	// JR cc,+/- r
-				logAddrInst(PC, inst, memory[PC+1]);
-				if (inst == 0x20) std::clog << "JR NZ/";
-				if (inst == 0x28) std::clog << "JR Z/";
-				if (inst == 0x30) std::clog << "JR NC/";
-				if (inst == 0x38) std::clog << "JR C/";
-				std::clog << "JR " << ccName((inst - 0x20) >> 3 )
-						  << (memory[PC+1] > 127 ? " -" : " +")
-						  << (memory[PC+1] > 127 ? 256 - memory[PC+1] : memory[PC+1])
-						  << " \t\t; " << std::hex
-						  << PC + (memory[PC+1] > 127 ? memory[PC+1] - 256 : memory[PC+1]) + 2
-						  << "h" << std::endl;
-				break;
-			}
-
-			case 0x22 : {	// LD (addr), HL
-				const uint16_t addr = memory[PC+2] * 256U + memory[PC+1];
-				logAddrInst(PC, inst, memory[PC+1], memory[PC+2]);
-				std::clog << "LD (" << std::hex << std::setw(4)
-						  << std::setfill('0') << addr << "h),HL" << std::endl;
-				logState(state);
-				break;
-			}
-
-			case 0x2A : {	// LD HL,(nn)
-				const uint16_t addr = memory[PC+2] * 256U + memory[PC+1];
-				logAddrInst(PC, inst, memory[PC+1], memory[PC+2]);
-				std::clog << "LD HL,(" << std::hex << std::setw(4)
-						  << std::setfill('0') << addr << "h)" << std::endl;
-				break;
-			}
-				
-			case 0x2F : { 	// CPL
-				logAddrInst(PC, inst);
-				std::clog << "CPL" << std::endl;
-				break;
-			}
-			
-			case 0x32 : {	// LD (nn),A
-				const uint16_t addr = memory[PC+2] * 256U + memory[PC+1];
-				logAddrInst(PC, inst, memory[PC+1], memory[PC+2]);
-				std::clog << "LD (" << std::setw(4) << std::setfill('0') 
-						  << addr << "h),A" << std::endl;
-				break;
-			}
-	
-			case 0x3A : {	// LD A,(addr)
-				const uint16_t addr = memory[PC+2] * 256U + memory[PC+1];
-				logAddrInst(PC, inst, memory[PC+1], memory[PC+2]);
-				std::clog << "LD A,(" << std::setw(4) << std::setfill('0') 
-						  << addr << "h)" << std::endl;
-				break;
-			}
-				
-			case 0x40 :
-			case 0x41 :
-			case 0x42 :
-			case 0x43 :
-			case 0x44 :
-			case 0x45 :
-			case 0x46 :
-			case 0x47 :
-			case 0x48 :
-			case 0x49 :
-			case 0x4A :
-			case 0x4B :
-			case 0x4C :
-			case 0x4D :
-			case 0x4E :
-			case 0x4F :
-			case 0x50 :
-			case 0x51 :
-			case 0x52 :
-			case 0x53 :
-			case 0x54 :
-			case 0x55 :
-			case 0x56 :
-			case 0x57 :
-			case 0x58 :
-			case 0x59 :
-			case 0x5A :
-			case 0x5B :
-			case 0x5C :
-			case 0x5D :
-			case 0x5E :
-			case 0x5F :
-			case 0x60 :
-			case 0x61 :
-			case 0x62 :
-			case 0x63 :
-			case 0x64 :
-			case 0x65 :
-			case 0x66 :
-			case 0x67 :
-			case 0x68 :
-			case 0x6A :
-			case 0x6B :
-			case 0x6C :
-			case 0x6D :
-			case 0x6E :
-			case 0x6F :
-			case 0x70 :
-			case 0x71 :
-			case 0x72 :
-			case 0x73 :
-			case 0x74 :
-			case 0x75 :
-//			case 0x76 : 	// HALT
-			case 0x77 :
-			case 0x78 :
-			case 0x79 :
-			case 0x7A :
-			case 0x7B :
-			case 0x7C :
-			case 0x7D :
-			case 0x7E :
-			case 0x7F : {	// LD r,r'
-				logAddrInst(PC, inst);
-				std::clog << "LD " << rName(inst >> 3) << ',' << rName(inst)
-						  << std::endl;
-				break;
-			}
-
-			case 0x76 : {	// HALT
-				logAddrInst(PC, inst);
-				std::clog << "HALT" << std::endl;
-				break;
-			}
-
-			case 0x80 :
-			case 0x81 :
-			case 0x82 :
-			case 0x83 :
-			case 0x84 :
-			case 0x85 :
-			case 0x86 :
-			case 0x87 : {	// ADD A,r
-				logAddrInst(PC, inst);
-				std::clog << "ADD A," << rName(inst) << std::endl;
-				break;
-			}
-			
-			case 0x88 :
-			case 0x89 :
-			case 0x8A :
-			case 0x8B :
-			case 0x8C :
-			case 0x8D :
-			case 0x8E :
-			case 0x8F : {	// ADC A,s
-				logAddrInst(PC, inst);
-				std::clog << "ADC A," << rName(inst) << std::endl;
-				break;
-			}
-			
-			case 0x90 :
-			case 0x91 :
-			case 0x92 :
-			case 0x93 :
-			case 0x94 :
-			case 0x95 :
-			case 0x96 :
-			case 0x97 : {	// SUB A,r
-				logAddrInst(PC, inst);
-				std::clog << "SUB A," << rName(inst) << std::endl;
-				break;
-			}
-			
-			case 0x98 :
-			case 0x99 :
-			case 0x9A :
-			case 0x9B :
-			case 0x9C :
-			case 0x9D :
-			case 0x9E :
-			case 0x9F : {	// SBC A,s
-				logAddrInst(PC, inst);
-				std::clog << "SBC A," << rName(inst) << std::endl;
-				break;
-			}
-			
-			case 0xA0 :
-			case 0xA1 :
-			case 0xA2 :
-			case 0xA3 :
-			case 0xA4 :
-			case 0xA5 :
-			case 0xA6 :
-			case 0xA7 : {	// AND r (A ^= r)
-				logAddrInst(PC, inst);
-				std::clog << "AND " << rName(inst) << std::endl;
-				break;
-			}
-			
-			case 0xA8 :
-			case 0xA9 :
-			case 0xAA :
-			case 0xAB :
-			case 0xAC :
-			case 0xAD :
-			case 0xAE :
-			case 0xAF : {	// XOR r (A (^)= r)
-				logAddrInst(PC, inst);
-				std::clog << "XOR " << rName(inst) << std::endl;
-				break;
-			}
-	
-			case 0xB0 :
-			case 0xB1 :
-			case 0xB2 :
-			case 0xB3 :
-			case 0xB4 :
-			case 0xB5 :
-			case 0xB6 :
-			case 0xB7 : { 	// OR r ( A ^= r)
-				logAddrInst(PC, inst);
-				std::clog << "OR " << rName(inst) << std::endl;
-				break;
-			}
-
-			case 0xB8 :
-			case 0xB9 :
-			case 0xBA :
-			case 0xBB :
-			case 0xBC :
-			case 0xBD :
-			case 0xBE :
-			case 0xBF : { 	// CP r ( A - r)
-				logAddrInst(PC, inst);
-				std::clog << "CP " << rName(inst) << std::endl;
-				break;
-			}
-			
-			case 0xC0 :
-			case 0xC8 :
-			case 0xD0 :
-			case 0xD8 :
-			case 0xE0 :
-			case 0xE8 :
-			case 0xF0 :
-			case 0xF8 : {	// RET cc
-				logAddrInst(PC, inst);
-				std::clog << "RET " << ccName(inst >> 3) << std::endl;
-				break;
-			}
-
-			case 0xC1 :
-			case 0xD1 :
-			case 0xE1 :
-			case 0xF1 : {	// POP qq
-				logAddrInst(PC, inst);
-				std::clog << "POP " << qqName(inst >> 4) << std::endl;
-				break;
-			}
-	
-			case 0xC2 :
-			case 0xCA :
-			case 0xD2 :
-			case 0xDA :
-			case 0xE2 :
-			case 0xEA :
-			case 0xF2 :
-			case 0xFA : { 	// JP cc,addr
-				const uint16_t addr = memory[PC+2] * 256U + memory[PC+1];
-				logAddrInst(PC, inst, memory[PC+1], memory[PC+2]);
-				std::clog << "JP " << ccName(inst >> 3) << ','
-						  << std::setw(4) << addr << 'h' << std::endl;
-				break;
-			}
-	
-			case 0xC3 : { 	// JP direct
-				const uint16_t addr = memory[PC+2] * 256U + memory[PC+1];
-				logAddrInst(PC, inst, memory[PC+1], memory[PC+2]);
-				std::clog << "JP " << std::setw(4) << addr << 'h' << std::endl;
-				break;
-			}
-
-			case 0xC4 :
-			case 0xCC :
-			case 0xD4 :
-			case 0xDC :
-			case 0xE4 :
-			case 0xEC :
-			case 0xF4 :
-			case 0xFC : { 	// CALL cc,addr
-				const uint16_t addr = memory[PC+2] * 256U + memory[PC+1];
-				logAddrInst(PC, inst, memory[PC+1], memory[PC+2]);
-				std::clog << "CALL " << ccName(inst >> 3) << ','
-						  << std::setw(4) << addr << 'h' << std::endl;
-				break;
-			}
-
-			case 0xC5 :
-			case 0xD5 :
-			case 0xE5 :
-			case 0xF5 : { 	// PUSH qq
-				logAddrInst(PC, inst);
-				std::clog << "PUSH " << qqName(inst >> 4) << std::endl;
-				break;
-			}
-
-			case 0xC6 : { // ADD A,n
-				const uint8_t v = memory[PC+1];
-				logAddrInst(PC, inst, v);
-				std::clog << "ADD A," << std::dec << unsigned(v);
-				if ((v >= ' ') && (v < 127))
-					std::clog << " \t; '" << char(v) << "'";
-				std::clog << std::endl;
-				break;
-			}
-
-			case 0xC9 : { 	// RET
-				logAddrInst(PC, inst);
-				std::clog << "RET" << std::endl;
-				break;
-			}
-	
-			case 0xCD : { 	// CALL nn
-				const uint16_t addr = memory[PC+2] * 256U + memory[PC+1];
-				logAddrInst(PC, inst, memory[PC+1], memory[PC+2]);
-				std::clog << "CALL " << std::hex << std::setw(4) << addr << 'h'
-						  << std::endl;
-				break;
-			}
-	
-			case 0xD6 : { // SUB n
-				const uint8_t v = memory[PC+1];
-				logAddrInst(PC, inst, v);
-				std::clog << "SUB " << std::dec << unsigned(v);
-				if ((v >= ' ') && (v < 127))
-					std::clog << " \t; '" << char(v) << "'";
-				std::clog << std::endl;
-				break;
-			}
-
-			case 0xDD: { // IX instructions 
-				logInstDD(state);
-				break;
-			}
-
-			case 0xDE : {
-				const uint8_t v = memory[PC+1];
-				logAddrInst(PC, inst, v);
-				std::clog << "SBC A," << std::dec << unsigned(v) << std::endl;
-				break;
-			}
-
-			case 0xE3 : { 	// ex (sp),hl
-				logAddrInst(PC, inst);
-				std::clog << "EX (SP),HL" << std::endl;
-				break;
-			}
-
-			case 0xE6 : { // AND n
-				const uint8_t v = memory[PC+1];
-				logAddrInst(PC, inst, v);
-				std::clog << "AND " << std::dec << unsigned(v);
-				if ((v >= ' ') && (v < 127))
-					std::clog << " \t; '" << char(v) << "'";
-				std::clog << std::endl;
-				break;
-			}
-	
-			case 0xE9 : {	// JP (HL)
-				logAddrInst(PC, inst);
-				std::clog << "JP (HL)" << std::endl;
-				break;
-			}
-
-			case 0xEB : { 	// EX DE,HL
-				logAddrInst(PC, inst);
-				std::clog << "EX DE,HL" << std::endl;
-				break;
-			}
-			
-			case 0xED: {
-				logInstED(state);
-				break;
-			}
-
-			case 0xF3 : {	// DI
-				logAddrInst(PC, inst);
-				std::clog << "DI" << std::endl;
-				break;
-			}
-	
-			case 0xF6 : { // OR n
-				const uint8_t v = memory[PC+1];
-				logAddrInst(PC, inst, v);
-				std::clog << "OR " << std::dec << unsigned(v);
-				if ((v >= ' ') && (v < 127))
-					std::clog << " \t; '" << char(v) << "'";
-				std::clog << std::endl;
-				break;
-			}
-	
-			case 0xFB : {	// EI
-				logAddrInst(PC, inst);
-				std::clog << "EI" << std::endl;
-				break;
-			}
-
-
-			case 0xF9 : {	// LD SP,HL
-				logAddrInst(PC, inst);
-				std::clog << "LD SP,HL" << std::endl;
-				break;
-			}
-
-			case 0xFD: {
-				logInstFD(state);
-				break;
-			}
-
-			case 0xFE : { // CP n (v - A ?)
-				const uint8_t v = memory[PC+1];
-				logAddrInst(PC, inst, v);
-				std::clog << "CP " << std::dec << unsigned(v);
-				if ((v >= ' ') && (v < 127))
-					std::clog << " \t; '" << char(v) << "'";
-				std::clog << std::endl;
-				break;
-			}
-
-			default:
-				std::clog << std::hex << std::setw(4) << std::setfill('0') << PC
-						  << "\t" << std::setw(2) << unsigned(memory[PC+0])
-						  << ' ' << unsigned(memory[PC+1]) << ' ' 
-						  << unsigned(memory[PC+2]) 
-						  << "\t\t\t : Unknown instruction in " << __FILE__ 
-						  << ": " << __LINE__ << " - " << __PRETTY_FUNCTION__ 
-						  << std::endl;
-				break;
-	
-		}
-	}
-
-	void logInstDD(const ZZ80State& state) const {
-		const uint16_t PC = state.Z_Z80_STATE_MEMBER_PC;
-		const uint8_t inst = memory[PC];
-		const uint8_t inst2 = memory[PC+1];
-		
-		switch (inst2) {
-			default:
-				std::clog << std::hex << std::setw(4) << std::setfill('0') << PC
-						  << "\t" << std::setw(2) << unsigned(memory[PC+0])
-						  << ' ' << unsigned(memory[PC+1]) << ' ' 
-						  << unsigned(memory[PC+2]) 
-						  << "\t\t\t : Unknown instruction in " << __FILE__
-						  << ": " << __LINE__ << " - " << __PRETTY_FUNCTION__
-						  << std::endl;
-				break;
-		}
-/*	
-	// IX instructions 
-	
-			case 0xDD : {
-				const uint8_t inst2 = memory[PC+1];
-				switch (inst2) {
-					case 0x2A : {	// LD IX,(nn)
-						const uint16_t addr = memory[PC+3] * 256U + memory[PC+2];
-	#if LOG
-						logAddrInst(PC, inst, inst2, memory[PC+2], memory[PC+3]);
-						std::clog << "LD IX,(" << std::hex << std::setw(4) << ")" << std::endl;
-	#endif
-						IX = memory[addr] + 256 * memory[addr+1];
-						PC += 4;
-						break;
-					}
-	
-					case 0xE1 : {	// POP IX
-	#if LOG
-						logAddrInst(PC, inst, inst2);
-						std::clog << "POP IX" << std::endl;
-	#endif
-						IX = memory[SP++];
-						IX += memory[SP++] * 256;
-						PC += 2;
-						break;
-					}
-	
-					case 0xE5 : {	// PUSH IX
-	#if LOG
-						logAddrInst(PC, inst, inst2);
-						std::clog << "PUSH IX" << std::endl;
-	#endif
-						memory[--SP] = (IX >> 8);
-						memory[--SP] = IX & 0x00FF;
-						PC += 2;
-						break;
-					}
-	
-					default:
-						logAddrInst(PC, inst, inst2, memory[PC+2]);
-						std::clog << " : Unknown IX instruction!" << std::endl;
-						
-						throw(std::string("Not emulated instruction"));
-						break;
-				
-				}
-				break;
-			}
-*/	
-	}
-
-	void logInstED(const ZZ80State& state) const {
-		const uint16_t PC = state.Z_Z80_STATE_MEMBER_PC;
-		const uint8_t inst = memory[PC];
-		const uint8_t inst2 = memory[PC+1];
-		
-		switch (inst2) {
-			case 0xB0 : {	// LDIR
-				logAddrInst(PC, inst, inst2);
-				std::clog << "LDIR" << std::endl;
-				break;
-			}
-
-			case 0x42 :
-			case 0x52 :
-			case 0x62 :
-			case 0x72 : {	// SBC HL,ss
-				logAddrInst(PC, inst, inst2);
-				std::clog << "SBC HL," << ddName(inst >> 4) << std::endl;
-				break;
-			}
-
-			case 0x43 :
-			case 0x53 :
-			case 0x63 :
-			case 0x73 : {	// LD (nn),dd
-				const uint16_t addr = memory[PC+3] * 256U + memory[PC+2];
-				logAddrInst(PC, inst, inst2, memory[PC+2], memory[PC+3]);
-				std::clog << "LD (" << std::hex << std::setw(4) << addr << "),"
-						  << ddName(inst >> 4) << std::endl;
-				break;
-			}
-			
-			case 0x44 : {	// NEG
-				logAddrInst(PC, inst, inst2);
-				std::clog << "NEG" << std::endl;
-				break;
-			}
-			
-			case 0x4B :
-			case 0x5B :
-			case 0x6B :
-			case 0x7B : {	// LD dd,(nn)
-				const uint16_t addr = memory[PC+3] * 256U + memory[PC+2];
-				logAddrInst(PC, inst, inst2, memory[PC+2], memory[PC+3]);
-				std::clog << "LD " << ddName(inst >> 4) << ",(" << std::hex
-						  << std::setw(4) << addr << ")" << std::endl;
-				break;
-			}
-
-			default:
-				std::clog << std::hex << std::setw(4) << std::setfill('0') << PC
-						  << "\t" << std::setw(2) << unsigned(memory[PC+0]) 
-						  << ' ' << unsigned(memory[PC+1]) << ' ' 
-						  << unsigned(memory[PC+2]) 
-						  << "\t\t\t : Unknown instruction in " << __FILE__ 
-						  << ": " << __LINE__ << " - " << __PRETTY_FUNCTION__ 
-						  << std::endl;
-				break;
-		}
-	}
-	
-	void logInstFD(const ZZ80State& state) const {
-		const uint16_t PC = state.Z_Z80_STATE_MEMBER_PC;
-		const uint8_t inst = memory[PC];
-		const uint8_t inst2 = memory[PC+1];
-		
-		switch (inst2) {
-
-			default:
-				std::clog << std::hex << std::setw(4) << std::setfill('0') << PC
-						  << "\t" << std::setw(2) << unsigned(memory[PC+0]) 
-						  << ' ' << unsigned(memory[PC+1]) << ' ' 
-						  << unsigned(memory[PC+2]) 
-						  << "\t\t\t : Unknown instruction in " << __FILE__ 
-						  << ": " << __LINE__ << " - " << __PRETTY_FUNCTION__ 
-						  << std::endl;
-				break;
+	static void logSpecAddr(std::ostream& aOut, const uint16_t aAddr, const uint8_t aFunction) {
+		const char* name = NULL;
+		switch (aAddr) {
+			case 0x0000 : name = "R E S E T   !"; break;
+			case 0x0003 : name = "W A R M   B O O T  !"; break;
+			case 0x0005 :
+				aOut << std::hex << std::setw(4) << std::setfill('0') << aAddr << " ; BDOS function #" << std::dec << int(aFunction) << " - ";
+				return;
+			case 0x0100 : name = "S T A R T   T H E   P R O G R A M --------------------------------------"; break;
 		}
+		if (const auto symbol = Symbols::at(aAddr)) name = symbol;
+		if (name) aOut << std::hex << std::setw(4) << std::setfill('0') << aAddr << " ; " << name << std::dec << std::endl;
 	}
 
-	void logAddrInst(const uint16_t addr, const uint8_t inst) const {
-		std::clog << std::hex << std::setw(4) << std::setfill('0') << addr
-				  << "\t" << std::setw(2) << unsigned(inst) << "\t\t\t\t";
-	}
-
-	void logAddrInst(const uint16_t addr, const uint8_t inst1, const uint8_t inst2) const {
-		std::clog << std::hex << std::setw(4) << std::setfill('0') << addr
-				  << "\t" << std::setw(2) << unsigned(inst1) << ' ' 
-				  << unsigned(inst2) << "\t\t\t";
-	}
-
-	void logAddrInst(const uint16_t addr, const uint8_t inst1, const uint8_t inst2, const uint8_t inst3) const {
-		std::clog << std::hex << std::setw(4) << std::setfill('0') << addr
-				  << "\t" << std::setw(2) << unsigned(inst1) << ' ' 
-				  << unsigned(inst2) << ' ' << unsigned(inst3) << "\t\t";
-	}
-	
-	void logAddrInst(const uint16_t addr, const uint8_t inst1, const uint8_t inst2, const uint8_t inst3, const uint8_t inst4) const {
-		std::clog << std::hex << std::setw(4) << std::setfill('0') << addr 
-				  << "\t" << std::setw(2) << unsigned(inst1) << ' ' 
-				  << unsigned(inst2) << ' ' << unsigned(inst3) << ' ' 
-				  << unsigned(inst4) << "\t\t";
-	}
-	
-	void logState(const ZZ80State& state) const {
-		std::clog << "CPU state" << std::endl;
-		std::clog << "A:" << std::hex << int(state.Z_Z80_STATE_MEMBER_A) << "h\t\t";
-		std::clog << "Flags: S:" << (state.Z_Z80_STATE_MEMBER_F & 0x80) <<
-			" Z:" << bool(state.Z_Z80_STATE_MEMBER_F & 0x40) <<
-			" Y:" << bool(state.Z_Z80_STATE_MEMBER_F & 0x20) <<
-			" H:" << bool(state.Z_Z80_STATE_MEMBER_F & 0x10) <<
-			" X:" << bool(state.Z_Z80_STATE_MEMBER_F & 0x08) <<
-			" P:" << bool(state.Z_Z80_STATE_MEMBER_F & 0x04) <<
-			" N:" << bool(state.Z_Z80_STATE_MEMBER_F & 0x02) <<
-			" C:" << bool(state.Z_Z80_STATE_MEMBER_F & 0x01);
-		std::clog << std::endl;		
-		std::clog << "BC:" << std::hex << int(state.Z_Z80_STATE_MEMBER_BC) << "h\t\t";
-		std::clog << "DE:" << std::hex << int(state.Z_Z80_STATE_MEMBER_DE) << std::endl;
-		std::clog << "HL:" << std::hex << int(state.Z_Z80_STATE_MEMBER_HL) << "h\t\t";
-		std::clog << "SP:" << std::hex << int(state.Z_Z80_STATE_MEMBER_SP) << std::endl;
-	}
-	
-	inline
-	const std::string rName(const uint8_t r) const {
-		static const char *const reg[] = 
-			{ "B", "C", "D", "E", "H", "L", "(HL)", "A" };
-		return reg[r & 0x07];
-	}
-
-	inline
-	const std::string ddName(const uint8_t dd) const {
-		static const char *const reg[] = 
-			{ "BC", "DE", "HL", "SP" };
-		return reg[dd & 0x03];
-	}
-	
-	inline
-	const std::string qqName(const uint8_t qq) const {
-		static const char *const reg[] = 
-			{ "BC", "DE", "HL", "SP" };
-		return reg[qq & 0x03];
-	}
-	
-	inline
-	const std::string ccName(const uint8_t cc) const {
-		static const char *const reg[] = 
-			{ "NZ", "Z", "NC", "C", "PO", "PE", "P", "M" };
-		return reg[cc & 0x07];
-	}
-	
 	bool parity(const uint8_t N) {
 		uint8_t y = N ^ (N >> 1);
 		y = y ^ (y >> 2);
@@ -1212,6 +735,40 @@ private:
  * Memory container.
  */	
 	uint8_t memory[MEMORY_SIZE * 1024];
+
+/**
+ * Console shared by the BDOS & the BIOS.
+ */
+	Console console;
+
+/**
+ * LIST, PUNCH & READER devices, routed by the IOBYTE.
+ */
+	Devices devices;
+
+/**
+ * Addresses handled by the run loop (bitmap): reset, warm boot, BDOS & BIOS
+ * entries, and the symbols when logging. The other instructions only cost a
+ * bit test.
+ */
+	uint8_t traps[MEMORY_SIZE * 128] = {};
+
+/**
+ * Instructions executed, the pending console output is checked every
+ * POLL_PERIOD instructions.
+ */
+	uint64_t ticks = 0;
+	static constexpr unsigned POLL_PERIOD = 65536;
+
+/**
+ * What the suspended run waits for.
+ */
+	Wait waiting = Wait::NONE;
+
+/**
+ * CPU cycles since power on.
+ */
+	uint64_t cycles = 0;
 	
 /**
  * BDOS functions & variables.
@@ -1222,5 +779,38 @@ private:
  * BDOS functions & variables.
  */
  	BIOS<MEMORY_SIZE, BIOS_ADDR> bios;
+
+/**
+ * Instruction trace or NULL.
+ */
+	Trace *const trace;
+
+/**
+ * Shadow call stack or NULL.
+ */
+	CallStack *const stack;
+
+/**
+ * Memory heat map or NULL, and whether the instructions are run by step().
+ */
+	HeatMap::Counters *const heat;
+	const bool instrumented = stack || heat;
+
+/**
+ * Live metrics, written with the other machines' (see Metrics).
+ */
+	Metrics::Machine metrics = {};
+
+/**
+ * Last opcodes of the run, for the opcode mix (OPCODES only).
+ */
+	OpcodeMix::History history;
+
+/**
+ * Machine sampled by the profiler timer, and cycles of the next sample when
+ * profiling by cycles.
+ */
+	const Profile::Target profiled { &cpu.state.Z_Z80_STATE_MEMBER_PC, memory, sizeof(memory) };
+	uint64_t sampling = Profile::period() ? Profile::period() : UINT64_MAX;
  	
 };
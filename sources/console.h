@@ -0,0 +1,647 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define CONSOLE_POSIX 1
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <csignal>
+#include <cstdlib>
+#else
+#include <io.h>
+#endif
+
+#include "script.h"
+#include "terminal.h"
+#include "screen.h"
+#include "recorder.h"
+
+/**
+ * Console shared by the BDOS & the BIOS.
+ * Output is kept in a buffer, written out with a single system call when:
+ *  * the program waits for input (CONIN, CONST, BDOS 1, 6, 10 & 11), so the
+ *    echo & prompts are immediately visible; a screen frame is only rendered
+ *    at once when the program really waits (the status polls keep the frame
+ *    rate),
+ *  * the buffer is full,
+ *  * the oldest pending byte is older than FLUSH_DELAY (see poll), only when
+ *    the output is a terminal or a connection. Redirected output is written
+ *    by full blocks.
+ * Input is read into a ring buffer, by the execution loop (see poll) and when
+ * the program waits for a character; the console status is answered from the
+ * ring buffer. A terminal is put in raw mode (no echo, no line editing, ^C
+ * given to the program, ^\ quits) and restored on exit or on a fatal signal;
+ * a redirected input has its LF & CR/LF line ends changed into CR.
+ * Headless, the input is typed by a script (see Script) and the output may be
+ * captured in a file.
+ * The escape sequences of an emulated terminal may be translated for the host
+ * terminal (see Terminal), on the whole buffer when it is written out. The
+ * result may feed a virtual screen (see Screen), rendered by frames.
+ * The session of the standard console may be recorded (see Recorder).
+ */
+class Console {
+public:
+/**
+ * Output buffer size.
+ */
+	static constexpr size_t BUFFER_SIZE = 16384;
+
+/**
+ * Maximum delay before the pending output is shown on a terminal.
+ */
+	static constexpr auto FLUSH_DELAY = std::chrono::milliseconds(20);
+
+/**
+ * Input ring buffer size (a power of 2).
+ */
+	static constexpr unsigned INPUT_SIZE = 4096;
+
+/**
+ * Thrown when the program waits for a character after the end of the input.
+ */
+	struct Closed : std::runtime_error {
+		Closed() : std::runtime_error("Console input closed") {}
+	};
+
+/**
+ * Console on the standard input & output, or headless as configured by
+ * setScript & setCapture, emulating the setTerminal terminal, and recorded
+ * as configured by Recorder::configure.
+ */
+	Console() :
+		Console(settings().scripted ? -1 : 0,
+				(settings().capture >= 0) ? settings().capture : 1,
+				settings().scripted ? &settings().script : NULL) {
+		unsigned columns = 80;
+		unsigned rows = 24;
+#ifdef CONSOLE_POSIX
+		winsize w;
+		if (interactive && !ioctl(fd, TIOCGWINSZ, &w) && w.ws_col && w.ws_row) {
+			columns = w.ws_col;
+			rows = w.ws_row;
+		}
+#endif
+		recorder = Recorder::create(columns, rows);
+	}
+
+/**
+ * Console emulating the setTerminal terminal.
+ * @param aIn Input descriptor, or -1 for none.
+ * @param aOut Output descriptor.
+ * @param aSource Input typed by a script, a connection... or NULL.
+ * @param aInteractive Output watched by a user (e.g. a connection), flushed
+ *        after FLUSH_DELAY as a terminal.
+ */
+	Console(const int aIn, const int aOut, ConsoleInput *const aSource = NULL, const bool aInteractive = false) :
+		in(aIn),
+		fd(aOut),
+		interactive(aInteractive || isatty(aOut)),
+#ifdef CONSOLE_POSIX
+		terminal(isatty(aIn)),
+#else
+		terminal(false),
+#endif
+		source(aSource),
+		screen(Screen::create()) {
+		emulate(settings().emulation);
+#ifdef CONSOLE_POSIX
+		if (terminal) rawMode(in);
+#endif
+	}
+
+/**
+ * Type the console input from a script, instead of the standard input.
+ * @param aPath Script file path.
+ * @return false if the script is invalid.
+ */
+	static bool setScript(const std::string& aPath) {
+		auto& h = settings();
+		h.scripted = h.script.load(aPath);
+		return h.scripted;
+	}
+
+/**
+ * Write the console output in a file, instead of the standard output.
+ * @param aPath File path, truncated.
+ * @return false if the file can't be created.
+ */
+	static bool setCapture(const std::string& aPath) {
+#ifdef CONSOLE_POSIX
+		const auto f = ::open(aPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#else
+		const auto f = ::_open(aPath.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#endif
+		if (f < 0) {
+			std::cerr << ">> Error creating capture file \"" << aPath << "\"!" << std::endl;
+			return false;
+		}
+		settings().capture = f;
+		return true;
+	}
+
+/**
+ * Emulated terminal of the consoles created next.
+ */
+	static void setTerminal(const Terminal::Type aType) {
+		settings().emulation = aType;
+	}
+
+/**
+ * Emulate a terminal on this console.
+ */
+	void emulate(const Terminal::Type aType) {
+		flush();
+		translator.select(aType);
+	}
+
+	Console(const Console&) = delete;
+	Console& operator=(const Console&) = delete;
+
+	~Console() {
+		flush();
+		if (screen) {
+			frame.clear();
+			screen->close(frame);
+			send(frame.data(), frame.size());
+			delete screen;
+		}
+		delete recorder;
+#ifdef CONSOLE_POSIX
+		if (terminal) restore();
+#endif
+	}
+
+/**
+ * Output a character.
+ */
+	void put(const char c) {
+		++sent;
+		if (!used) since = std::chrono::steady_clock::now();
+		if (source) source->output(&c, 1);
+		buffer[used++] = c;
+		if (used == BUFFER_SIZE) flush(false);
+	}
+
+/**
+ * Output a string.
+ * @param aString Characters.
+ * @param aLength Number of characters.
+ */
+	void write(const char* aString, size_t aLength) {
+		sent += aLength;
+		if (!used && aLength) since = std::chrono::steady_clock::now();
+		if (source) source->output(aString, aLength);
+		while (aLength) {
+			const auto n = std::min(aLength, BUFFER_SIZE - used);
+			memcpy(buffer + used, aString, n);
+			used += n;
+			aString += n;
+			aLength -= n;
+			if (used == BUFFER_SIZE) flush(false);
+		}
+	}
+
+/**
+ * Write out the pending output. With a screen, the output updates it and a
+ * frame is rendered.
+ * @param aNow Render the frame at once (the program waits for input), else
+ *        only if due according to the frame rate.
+ */
+	void flush(const bool aNow = true) {
+		if (used) {
+			std::cout.flush();		// banners & messages written before
+			const char* p = buffer;
+			auto n = used;
+			used = 0;
+			if (translator.selected() != Terminal::Type::NONE) {
+				translated.clear();
+				translator.translate(buffer, n, translated);
+				p = translated.data();
+				n = translated.size();
+			}
+			if (!screen) {
+				send(p, n);
+				return;
+			}
+			screen->write(p, n);
+		}
+		if (screen && (aNow ? screen->damaged() : screen->due())) {
+			frame.clear();
+			screen->render(frame);
+			send(frame.data(), frame.size());
+		}
+	}
+
+/**
+ * Write out the pending output if it is waiting for too long on a terminal
+ * (or render the due screen frame), and read the waiting input. Called
+ * regularly by the execution loop.
+ */
+	void poll() {
+		if (screen) {
+			if (used || screen->damaged()) flush(false);
+		} else if (used && interactive && (std::chrono::steady_clock::now() - since >= FLUSH_DELAY)) {
+			flush();
+		}
+		fill(false);
+	}
+
+private:
+/**
+ * Write characters on the output descriptor, or give them to the source
+ * delivering them itself.
+ */
+	void send(const char* p, size_t n) {
+		if (recorder) recorder->record(Recorder::OUTPUT, p, n);
+		if (source && source->deliver(p, n)) return;
+		while (n) {
+#ifdef _WIN32
+			const auto w = ::_write(fd, p, unsigned(n));
+#else
+			const auto w = ::write(fd, p, n);
+#endif
+			if (w <= 0) {
+				if ((w < 0) && (errno == EINTR)) continue;
+				return;		// output closed: drop
+			}
+			p += w;
+			n -= w;
+		}
+	}
+
+public:
+/**
+ * @return the bytes read by the programs.
+ */
+	uint64_t bytesRead() const {
+		return received;
+	}
+
+/**
+ * @return the bytes written by the programs.
+ */
+	uint64_t bytesWritten() const {
+		return sent;
+	}
+
+/**
+ * Wait for a character.
+ * @return the character read.
+ * @throw Closed at the end of the input.
+ */
+	uint8_t get() {
+		flush();
+		while (head == tail) {
+			if (recorder) recorder->flush();
+			if (!fill(true)) throw Closed();
+		}
+		++received;
+		return input[head++ % INPUT_SIZE];
+	}
+
+/**
+ * @return true if a character is waiting (no system call).
+ */
+	bool status() {
+		flush(false);
+		if ((head == tail) && source) fill(false);
+		return head != tail;
+	}
+
+/**
+ * Return a character if one is waiting (no system call).
+ * @param c Character read.
+ * @return true if a character was read.
+ */
+	bool poll(char& c) {
+		flush(false);
+		if ((head == tail) && source) fill(false);
+		if (head == tail) return false;
+		++received;
+		c = input[head++ % INPUT_SIZE];
+		return true;
+	}
+
+/**
+ * @return true if reading a character won't wait: one is waiting, or the
+ *         input is closed (get() then throws). Else the screen is rendered
+ *         at once, as the program is about to wait.
+ */
+	bool ready() {
+		flush(false);
+		if (head == tail) fill(false);
+		if ((head != tail) || closed) return true;
+		flush();
+		return false;
+	}
+
+/**
+ * Wait for some input.
+ * @throw Closed at the end of the input.
+ */
+	void wait() {
+		flush();
+		if (recorder && (head == tail)) recorder->flush();
+		if ((head == tail) && !fill(true)) throw Closed();
+	}
+
+/**
+ * Edit a line with the waiting characters, with echo & line editing: BS or
+ * DEL erase the last character, ^U or ^X the whole line. The line ends with
+ * CR or LF, or when full.
+ * @param aMax Maximum number of characters.
+ * @return true when the line is ended, to be taken by getLine().
+ * @throw Closed at the end of the input.
+ */
+	bool editLine(const size_t aMax) {
+		while (!ended) {
+			if (line.size() >= aMax) {
+				ended = true;
+				break;
+			}
+			if (!ready()) return false;
+			const char c = get();
+			if ((c == '\r') || (c == '\n')) {
+				ended = true;
+			} else if ((c == 0x08) || (c == 0x7F)) {
+				if (!line.empty()) erase(line);
+			} else if ((c == 0x15) || (c == 0x18)) {
+				while (!line.empty()) erase(line);
+			} else {
+				line.push_back(c);
+				echo(c);
+			}
+		}
+		return true;
+	}
+
+/**
+ * Wait for a line (see editLine); CR is echoed at its end.
+ * @param aMax Maximum number of characters.
+ * @return the line read, without its end.
+ */
+	std::string getLine(const size_t aMax) {
+		while (!editLine(aMax)) wait();
+		put('\r');
+		std::string s;
+		s.swap(line);
+		ended = false;
+		return s;
+	}
+
+private:
+/**
+ * Echo a character, control characters as ^X.
+ */
+	void echo(const char c) {
+		if ((c < ' ') && (c != '\t')) {
+			put('^');
+			put(c + '@');
+		} else {
+			put(c);
+		}
+	}
+
+/**
+ * Remove the last character of a line & its echo.
+ */
+	void erase(std::string& aLine) {
+		const auto n = ((aLine.back() < ' ') && (aLine.back() != '\t')) ? 2 : 1;
+		for (auto i = 0; i < n; ++i) write("\b \b", 3);
+		aLine.pop_back();
+	}
+
+/**
+ * Read the waiting input into the ring buffer.
+ * @param aWait Wait for at least one byte.
+ * @return false at the end of the input.
+ */
+	bool fill(const bool aWait) {
+		if (closed) return false;
+		const auto room = INPUT_SIZE - (tail - head);
+		if (!room) return true;
+		char buf[256];
+		if (source) {
+			const auto n = source->input(buf, std::min<size_t>(room, sizeof(buf)), aWait);
+			if (!n && source->done()) {
+				closed = true;
+				return false;
+			}
+			if (recorder) recorder->record(Recorder::INPUT, buf, n);
+			for (size_t i = 0; i < n; ++i) input[tail++ % INPUT_SIZE] = buf[i];
+			return true;
+		}
+		if (in < 0) {
+			closed = true;
+			return false;
+		}
+#ifdef CONSOLE_POSIX
+		pollfd p = { in, POLLIN, 0 };
+		const auto r = ::poll(&p, 1, aWait ? -1 : 0);
+		if (r <= 0) return true;	// nothing or interrupted
+		const auto n = ::read(in, buf, std::min<size_t>(room, sizeof(buf)));
+		if (n < 0) return true;
+#else
+		std::streamsize n;
+		if (aWait) {
+			n = std::cin.get(buf[0]) ? 1 : 0;
+		} else {
+			n = std::cin.readsome(buf, std::min<size_t>(room, sizeof(buf)));
+			if (!n) return true;
+		}
+#endif
+		if (!n) {
+			closed = true;
+			return false;
+		}
+		if (recorder) recorder->record(Recorder::INPUT, buf, n);
+		for (auto i = 0; i < n; ++i) {
+			auto c = buf[i];
+			if (!terminal) {	// CR/LF or LF -> CR
+				const auto cr = lastCR;
+				lastCR = (c == '\r');
+				if (c == '\n') {
+					if (cr) continue;
+					c = '\r';
+				}
+			}
+			input[tail++ % INPUT_SIZE] = c;
+		}
+		return true;
+	}
+
+/**
+ * Configuration used by the default constructor.
+ */
+	struct Settings {
+		Script script;
+		bool scripted = false;
+		int capture = -1;
+		Terminal::Type emulation = Terminal::Type::NONE;
+	};
+
+	static Settings& settings() {
+		static Settings h;
+		return h;
+	}
+
+#ifdef CONSOLE_POSIX
+/**
+ * Terminal settings before the raw mode, restored on exit.
+ */
+	struct Saved {
+		int fd = -1;
+		termios settings;
+	};
+
+	static Saved& saved() {
+		static Saved s;
+		return s;
+	}
+
+/**
+ * Put a terminal in raw mode, once.
+ */
+	static void rawMode(const int aFd) {
+		auto& s = saved();
+		if ((s.fd >= 0) || (tcgetattr(aFd, &s.settings) < 0)) return;
+		s.fd = aFd;
+		atexit(restore);
+		for (const auto sig : { SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT }) {
+			std::signal(sig, onSignal);
+		}
+		auto t = s.settings;
+		t.c_iflag &= ~(BRKINT | ICRNL | INLCR | IGNCR | ISTRIP | IXON);
+		t.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+		t.c_cc[VINTR] = _POSIX_VDISABLE;	// ^C to the program
+		t.c_cc[VSUSP] = _POSIX_VDISABLE;
+		t.c_cc[VMIN] = 1;
+		t.c_cc[VTIME] = 0;
+		tcsetattr(aFd, TCSANOW, &t);
+	}
+
+/**
+ * Restore the terminal settings (async signal safe).
+ */
+	static void restore() {
+		const auto& s = saved();
+		if (s.fd >= 0) tcsetattr(s.fd, TCSANOW, &s.settings);
+	}
+
+	static void onSignal(const int aSignal) {
+		restore();
+		std::signal(aSignal, SIG_DFL);
+		std::raise(aSignal);
+	}
+#endif
+
+/**
+ * Input descriptor.
+ */
+	const int in;
+
+/**
+ * Output descriptor.
+ */
+	const int fd;
+
+/**
+ * Output is a terminal.
+ */
+	const bool interactive;
+
+/**
+ * Input is a terminal in raw mode.
+ */
+	const bool terminal;
+
+/**
+ * Input typed by a script, a connection... or NULL.
+ */
+	ConsoleInput *const source;
+
+/**
+ * Waiting input, from head to tail (free running indexes).
+ */
+	char input[INPUT_SIZE];
+	unsigned head = 0;
+	unsigned tail = 0;
+
+/**
+ * Bytes read & written by the programs.
+ */
+	uint64_t received = 0;
+	uint64_t sent = 0;
+
+/**
+ * End of the input reached.
+ */
+	bool closed = false;
+
+/**
+ * Line being edited, and its end reached.
+ */
+	std::string line;
+	bool ended = false;
+
+/**
+ * Last input character was a CR (redirected input).
+ */
+	bool lastCR = false;
+
+/**
+ * Pending output.
+ */
+	char buffer[BUFFER_SIZE];
+	size_t used = 0;
+
+/**
+ * Emulated terminal, and its translated output.
+ */
+	Terminal translator;
+	std::string translated;
+
+/**
+ * Virtual screen or NULL, and its rendered frame.
+ */
+	Screen *const screen;
+	std::string frame;
+
+/**
+ * Session recorder or NULL.
+ */
+	Recorder* recorder = NULL;
+
+/**
+ * Time of the oldest pending byte.
+ */
+	std::chrono::steady_clock::time_point since;
+};
@@ -0,0 +1,55 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Console input typed by another party than the host terminal: a script, a
+ * server connection...
+ */
+class ConsoleInput {
+public:
+	virtual ~ConsoleInput() {}
+
+/**
+ * Called with the characters written by the program.
+ */
+	virtual void output(const char* aString, const size_t aLength) = 0;
+
+/**
+ * Take the output written out by the console, instead of its descriptor.
+ * @return false to let the console write it.
+ */
+	virtual bool deliver(const char*, const size_t) {
+		return false;
+	}
+
+/**
+ * Take the typed characters.
+ * @param aBuffer Destination.
+ * @param aSize Destination size.
+ * @param aWait The program waits for a character.
+ * @return the number of characters taken, 0 if none is typed yet.
+ */
+	virtual size_t input(char aBuffer[], const size_t aSize, const bool aWait) = 0;
+
+/**
+ * @return true when nothing more will be typed.
+ */
+	virtual bool done() const = 0;
+};
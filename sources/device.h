@@ -0,0 +1,329 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+
+#include "console.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <csignal>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#define DEVICE_POSIX 1
+#else
+#include <io.h>
+#endif
+
+/**
+ * Host stream of a CP/M character device (LIST, PUNCH or READER): a file, a
+ * pipe to or from a command, or a socket. The characters are buffered both
+ * ways, so a printed report only takes a few host writes.
+ */
+class Device {
+public:
+	static constexpr size_t BUFFER_SIZE = 65536;
+
+	Device() = default;
+	Device(const Device&) = delete;
+	Device& operator=(const Device&) = delete;
+
+	~Device() {
+		close();
+	}
+
+/**
+ * Open the host stream.
+ * @param aSpec "FILE", "|COMMAND" (pipe to or from the command), "unix:PATH"
+ *        or "tcp:HOST:PORT" (sockets, not on Windows).
+ * @param aOutput Written (LIST, PUNCH) or read (READER).
+ * @return false if it can't be opened.
+ */
+	bool open(const std::string& aSpec, const bool aOutput) {
+		close();
+		output = aOutput;
+		if (!aSpec.empty() && (aSpec[0] == '|')) {
+#ifdef DEVICE_POSIX
+			std::signal(SIGPIPE, SIG_IGN);		// the command may stop reading
+			pipe = popen(aSpec.c_str() + 1, aOutput ? "w" : "r");
+			if (pipe) fd = fileno(pipe);
+#else
+			pipe = _popen(aSpec.c_str() + 1, aOutput ? "wb" : "rb");
+			if (pipe) fd = _fileno(pipe);
+#endif
+		} else if (!aSpec.compare(0, 5, "unix:") || !aSpec.compare(0, 4, "tcp:")) {
+#ifdef DEVICE_POSIX
+			std::signal(SIGPIPE, SIG_IGN);
+			fd = connect(aSpec);
+#else
+			std::cerr << ">> Sockets are not available on this platform!" << std::endl;
+			return false;
+#endif
+		} else {
+#ifdef DEVICE_POSIX
+			fd = aOutput ? ::open(aSpec.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : ::open(aSpec.c_str(), O_RDONLY | O_CLOEXEC);
+#else
+			fd = aOutput ? ::_open(aSpec.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644) : ::_open(aSpec.c_str(), _O_RDONLY | _O_BINARY);
+#endif
+		}
+		if (fd < 0) {
+			std::cerr << ">> Error opening device \"" << aSpec << "\": " << strerror(errno) << "!" << std::endl;
+			return false;
+		}
+		name = aSpec;
+		return true;
+	}
+
+/**
+ * @return true if a host stream is opened.
+ */
+	bool opened() const {
+		return fd >= 0;
+	}
+
+/**
+ * Output a character.
+ */
+	void put(const char c) {
+		buffer[used++] = c;
+		if (used == BUFFER_SIZE) flush();
+	}
+
+/**
+ * Input a character.
+ * @return the character, or -1 at the end of the stream.
+ */
+	int get() {
+		if (head == used) {
+			head = used = 0;
+			while (true) {
+#ifdef DEVICE_POSIX
+				const auto n = ::read(fd, buffer, BUFFER_SIZE);
+#else
+				const auto n = ::_read(fd, buffer, unsigned(BUFFER_SIZE));
+#endif
+				if ((n < 0) && (errno == EINTR)) continue;
+				if (n <= 0) return -1;
+				used = n;
+				break;
+			}
+		}
+		return uint8_t(buffer[head++]);
+	}
+
+/**
+ * Write out the pending output. On error, the output is dropped.
+ */
+	void flush() {
+		if (!output) return;
+		const char* p = buffer;
+		auto n = used;
+		used = 0;
+		while (n && (fd >= 0)) {
+#ifdef DEVICE_POSIX
+			const auto w = ::write(fd, p, n);
+#else
+			const auto w = ::_write(fd, p, unsigned(n));
+#endif
+			if (w <= 0) {
+				if ((w < 0) && (errno == EINTR)) continue;
+				std::cerr << ">> Error writing device \"" << name << "\": " << strerror(errno) << "!" << std::endl;
+				close();
+				return;
+			}
+			p += w;
+			n -= w;
+		}
+	}
+
+/**
+ * Flush & close the host stream.
+ */
+	void close() {
+		if (fd < 0) return;
+		flush();
+		if (pipe) {
+#ifdef DEVICE_POSIX
+			pclose(pipe);
+#else
+			_pclose(pipe);
+#endif
+		} else {
+#ifdef DEVICE_POSIX
+			::close(fd);
+#else
+			::_close(fd);
+#endif
+		}
+		pipe = NULL;
+		fd = -1;
+		head = used = 0;
+	}
+
+protected:
+#ifdef DEVICE_POSIX
+/**
+ * Connect a socket.
+ * @param aSpec "unix:PATH" or "tcp:HOST:PORT".
+ * @return the socket or -1.
+ */
+	static int connect(const std::string& aSpec) {
+		if (!aSpec.compare(0, 5, "unix:")) {
+			sockaddr_un addr = {};
+			addr.sun_family = AF_UNIX;
+			const auto path = aSpec.substr(5);
+			if (path.size() >= sizeof(addr.sun_path)) {
+				errno = ENAMETOOLONG;
+				return -1;
+			}
+			strcpy(addr.sun_path, path.c_str());
+			const auto s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if ((s >= 0) && (::connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)) {
+				::close(s);
+				return -1;
+			}
+			return s;
+		}
+		const auto colon = aSpec.rfind(':');
+		const auto host = aSpec.substr(4, colon - 4);
+		const auto port = aSpec.substr(colon + 1);
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* list;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &list)) {
+			errno = EHOSTUNREACH;
+			return -1;
+		}
+		auto s = -1;
+		for (auto a = list; a && (s < 0); a = a->ai_next) {
+			s = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+			if ((s >= 0) && (::connect(s, a->ai_addr, a->ai_addrlen) < 0)) {
+				::close(s);
+				s = -1;
+			}
+		}
+		freeaddrinfo(list);
+		return s;
+	}
+#endif
+
+private:
+	std::string name;
+	bool output = false;
+	int fd = -1;
+	FILE* pipe = NULL;
+
+/**
+ * Pending output (used), or input read from head to used.
+ */
+	char buffer[BUFFER_SIZE];
+	size_t used = 0;
+	size_t head = 0;
+};
+
+/**
+ * Routing of the CP/M logical devices by the IOBYTE (page zero, 0003H): each
+ * 2-bit field assigns a physical device.
+ *   bits 7-6	LST:	TTY: CRT: (console), LPT: UL1: (list device)
+ *   bits 5-4	PUN:	TTY: (console), PTP: UP1: UP2: (punch device)
+ *   bits 3-2	RDR:	TTY: (console), PTR: UR1: UR2: (reader device)
+ *   bits 1-0	CON:	always the console
+ * The physical devices are host streams, shared by all the machines of the
+ * process (see assign). Without one, the output is dropped and the reader
+ * returns ^Z (end of file).
+ * @see https://seasip.info/Cpm/iobyte.html
+ */
+class Devices {
+public:
+/**
+ * IOBYTE at cold boot: LST:=LPT: PUN:=PTP: RDR:=PTR: CON:=CRT:
+ */
+	static constexpr uint8_t IOBYTE = 0x95;
+
+	enum Port { READER, PUNCH, LIST };
+
+	explicit Devices(Console& aConsole) :
+		console(aConsole) {
+	}
+
+/**
+ * Assign a host stream to a physical device (see Device::open).
+ * @return false if it can't be opened.
+ */
+	static bool assign(const Port aPort, const std::string& aSpec) {
+		return device(aPort).open(aSpec, aPort != READER);
+	}
+
+/**
+ * Write out the pending output of the devices, at the end of each program.
+ */
+	static void flush() {
+		device(LIST).flush();
+		device(PUNCH).flush();
+	}
+
+	void list(const uint8_t aIOByte, const char c) {
+		if ((aIOByte >> 6) < 2) console.put(c);
+		else put(LIST, c);
+	}
+
+	void punch(const uint8_t aIOByte, const char c) {
+		if (!((aIOByte >> 4) & 0x03)) console.put(c);
+		else put(PUNCH, c);
+	}
+
+/**
+ * @return true if the reader is the console (so it may wait for input).
+ */
+	static bool readsConsole(const uint8_t aIOByte) {
+		return !((aIOByte >> 2) & 0x03);
+	}
+
+/**
+ * @return the next character of the reader, ^Z at its end.
+ * @throw Console::Closed at the end of the console input.
+ */
+	uint8_t reader(const uint8_t aIOByte) {
+		if (readsConsole(aIOByte)) return console.get();
+		auto& d = device(READER);
+		const auto c = d.opened() ? d.get() : -1;
+		return (c < 0) ? 0x1A : c;
+	}
+
+private:
+	static Device& device(const Port aPort) {
+		static Device devices[3];
+		return devices[aPort];
+	}
+
+	static void put(const Port aPort, const char c) {
+		auto& d = device(aPort);
+		if (d.opened()) d.put(c);
+	}
+
+	Console& console;
+};
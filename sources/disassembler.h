@@ -0,0 +1,322 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+
+/**
+ * Z80 disassembler: all the instructions, documented or not, with the CB, DD,
+ * ED, FD, DDCB & FDCB prefixes, in Zilog mnemonics (numbers in hexadecimal,
+ * e.g. "LD (IX+05h),3Eh"). The text is written into a buffer of the caller,
+ * without allocation.
+ * The instructions are read from constant tables of templates, where the
+ * lower case letters are the operands:
+ *   n	byte				w	word
+ *   e	relative jump (target)		m	(HL), (IX+d) or (IY+d)
+ *   x	HL, IX or IY			h, l	H & L, or the halves of IX or IY
+ *   r	restart address
+ * An index prefix (DD, FD) before an instruction without HL is shown alone, as
+ * the processor ignores it.
+ */
+class Disassembler {
+public:
+/**
+ * Buffer size enough for any instruction.
+ */
+	static constexpr size_t TEXT_SIZE = 24;
+
+/**
+ * Longest instruction, in bytes.
+ */
+	static constexpr unsigned MAX_LENGTH = 4;
+
+/**
+ * Disassemble an instruction.
+ * @param aCode Instruction bytes (MAX_LENGTH bytes are read).
+ * @param aAddr Instruction address, for the relative jumps.
+ * @param aText Buffer of the text, ended by a null character.
+ * @param aSize Buffer size, the text is truncated to it.
+ * @return the instruction length (1 to 4 bytes).
+ */
+	static unsigned disassemble(const uint8_t aCode[], const uint16_t aAddr, char aText[], const size_t aSize) {
+		Text t(aText, aSize);
+		unsigned length;
+		switch (aCode[0]) {
+			case 0xCB :
+				length = bits(t, aCode + 1, 0, 0);
+				break;
+			case 0xED :
+				length = extended(t, aCode + 1, aAddr);
+				break;
+			case 0xDD :
+			case 0xFD : {
+				const unsigned index = (aCode[0] == 0xDD) ? 1 : 2;
+				if (aCode[1] == 0xCB) {
+					length = bits(t, aCode + 3, index, int8_t(aCode[2]));
+				} else if (MAIN[aCode[1]] && USES_HL[aCode[1]]) {
+					length = 1 + format(t, MAIN[aCode[1]], aCode + 1, aAddr + 1, index);
+				} else {
+					t.put("DB ");
+					t.byte(aCode[0]);
+					length = 1;
+				}
+				break;
+			}
+			default :
+				length = format(t, MAIN[aCode[0]], aCode, aAddr, 0);
+				break;
+		}
+		t.end();
+		return length;
+	}
+
+protected:
+/**
+ * Bounded text.
+ */
+	class Text {
+	public:
+		Text(char aText[], const size_t aSize) :
+			p(aText),
+			last(aText + (aSize ? aSize - 1 : 0)),
+			text(aSize ? aText : NULL) {
+		}
+
+		void put(const char c) {
+			if (p < last) *p++ = c;
+		}
+
+		void put(const char* aString) {
+			while (*aString) put(*aString++);
+		}
+
+		void byte(const uint8_t aValue) {
+			put(HEX[aValue >> 4]);
+			put(HEX[aValue & 0x0F]);
+			put('h');
+		}
+
+		void word(const uint16_t aValue) {
+			put(HEX[aValue >> 12]);
+			put(HEX[(aValue >> 8) & 0x0F]);
+			put(HEX[(aValue >> 4) & 0x0F]);
+			put(HEX[aValue & 0x0F]);
+			put('h');
+		}
+
+		void index(const unsigned aIndex, const int aDisplacement) {
+			put(aIndex == 1 ? "(IX" : "(IY");
+			put(aDisplacement < 0 ? '-' : '+');
+			byte(uint8_t(aDisplacement < 0 ? -aDisplacement : aDisplacement));
+			put(')');
+		}
+
+		void end() {
+			if (text) *p = '\0';
+		}
+
+	private:
+		static constexpr char HEX[] = "0123456789ABCDEF";
+
+		char* p;
+		char *const last;
+		char *const text;
+	};
+
+/**
+ * Write a template of the MAIN table.
+ * @param aCode Opcode & operands.
+ * @param aAddr Opcode address (after the index prefix).
+ * @param aIndex 0 for HL, 1 for IX, 2 for IY.
+ * @return the length from the opcode.
+ */
+	static unsigned format(Text& t, const char* aTemplate, const uint8_t aCode[], const uint16_t aAddr, const unsigned aIndex) {
+		unsigned p = 1;
+		for (; *aTemplate; ++aTemplate) {
+			switch (*aTemplate) {
+				case 'n' :
+					t.byte(aCode[p++]);
+					break;
+				case 'w' :
+					t.word(aCode[p] | (aCode[p + 1] << 8));
+					p += 2;
+					break;
+				case 'e' : {
+					const int8_t d = aCode[p++];
+					t.word(uint16_t(aAddr + p + d));
+					break;
+				}
+				case 'm' :
+					if (aIndex) t.index(aIndex, int8_t(aCode[p++]));
+					else t.put("(HL)");
+					break;
+				case 'r' :
+					t.byte(aCode[0] & 0x38);
+					break;
+				case 'x' :
+					t.put(PAIRS[aIndex]);
+					break;
+				case 'h' :
+					t.put(HIGHS[aIndex]);
+					break;
+				case 'l' :
+					t.put(LOWS[aIndex]);
+					break;
+				default :
+					t.put(*aTemplate);
+					break;
+			}
+		}
+		return p;
+	}
+
+/**
+ * CB instructions: rotations, shifts & bits.
+ * @param aCode Opcode.
+ * @param aIndex 0 for CB, 1 for DDCB, 2 for FDCB.
+ * @param aDisplacement Index displacement (DDCB & FDCB).
+ * @return the length from the first prefix.
+ */
+	static unsigned bits(Text& t, const uint8_t aCode[], const unsigned aIndex, const int aDisplacement) {
+		const uint8_t op = aCode[0];
+		const unsigned y = (op >> 3) & 0x07;
+		const unsigned z = op & 0x07;
+		if (op < 0x40) {
+			t.put(ROTATIONS[y]);
+		} else {
+			t.put(BITS[(op >> 6) - 1]);
+			t.put(char('0' + y));
+			t.put(',');
+		}
+		if (!aIndex) {
+			t.put(REGISTERS[z]);
+			return 2;
+		}
+		t.index(aIndex, aDisplacement);
+		if ((z != 6) && ((op & 0xC0) != 0x40)) {	// undocumented: copy in a register
+			t.put(',');
+			t.put(REGISTERS[z]);
+		}
+		return 4;
+	}
+
+/**
+ * ED instructions.
+ * @param aCode Opcode.
+ * @param aAddr Prefix address.
+ * @return the length from the prefix.
+ */
+	static unsigned extended(Text& t, const uint8_t aCode[], const uint16_t aAddr) {
+		const uint8_t op = aCode[0];
+		const char* s = NULL;
+		if ((op >= 0x40) && (op < 0x80)) s = EXTENDED[op - 0x40];
+		else if ((op >= 0xA0) && (op < 0xC0)) s = BLOCKS[op - 0xA0];
+		if (!s) {
+			t.put("DB EDh,");
+			t.byte(op);
+			return 2;
+		}
+		return 1 + format(t, s, aCode, aAddr + 1, 0);
+	}
+
+	static constexpr const char* PAIRS[] = { "HL", "IX", "IY" };
+	static constexpr const char* HIGHS[] = { "H", "IXH", "IYH" };
+	static constexpr const char* LOWS[] = { "L", "IXL", "IYL" };
+	static constexpr const char* REGISTERS[] = { "B", "C", "D", "E", "H", "L", "(HL)", "A" };
+	static constexpr const char* ROTATIONS[] = { "RLC ", "RRC ", "RL ", "RR ", "SLA ", "SRA ", "SLL ", "SRL " };
+	static constexpr const char* BITS[] = { "BIT ", "RES ", "SET " };
+
+/**
+ * Unprefixed instructions (NULL for the prefixes).
+ */
+	static constexpr const char* MAIN[256] = {
+		"NOP",		"LD BC,w",	"LD (BC),A",	"INC BC",	"INC B",	"DEC B",	"LD B,n",	"RLCA",
+		"EX AF,AF'",	"ADD x,BC",	"LD A,(BC)",	"DEC BC",	"INC C",	"DEC C",	"LD C,n",	"RRCA",
+		"DJNZ e",	"LD DE,w",	"LD (DE),A",	"INC DE",	"INC D",	"DEC D",	"LD D,n",	"RLA",
+		"JR e",		"ADD x,DE",	"LD A,(DE)",	"DEC DE",	"INC E",	"DEC E",	"LD E,n",	"RRA",
+		"JR NZ,e",	"LD x,w",	"LD (w),x",	"INC x",	"INC h",	"DEC h",	"LD h,n",	"DAA",
+		"JR Z,e",	"ADD x,x",	"LD x,(w)",	"DEC x",	"INC l",	"DEC l",	"LD l,n",	"CPL",
+		"JR NC,e",	"LD SP,w",	"LD (w),A",	"INC SP",	"INC m",	"DEC m",	"LD m,n",	"SCF",
+		"JR C,e",	"ADD x,SP",	"LD A,(w)",	"DEC SP",	"INC A",	"DEC A",	"LD A,n",	"CCF",
+
+		"LD B,B",	"LD B,C",	"LD B,D",	"LD B,E",	"LD B,h",	"LD B,l",	"LD B,m",	"LD B,A",
+		"LD C,B",	"LD C,C",	"LD C,D",	"LD C,E",	"LD C,h",	"LD C,l",	"LD C,m",	"LD C,A",
+		"LD D,B",	"LD D,C",	"LD D,D",	"LD D,E",	"LD D,h",	"LD D,l",	"LD D,m",	"LD D,A",
+		"LD E,B",	"LD E,C",	"LD E,D",	"LD E,E",	"LD E,h",	"LD E,l",	"LD E,m",	"LD E,A",
+		"LD h,B",	"LD h,C",	"LD h,D",	"LD h,E",	"LD h,h",	"LD h,l",	"LD H,m",	"LD h,A",
+		"LD l,B",	"LD l,C",	"LD l,D",	"LD l,E",	"LD l,h",	"LD l,l",	"LD L,m",	"LD l,A",
+		"LD m,B",	"LD m,C",	"LD m,D",	"LD m,E",	"LD m,H",	"LD m,L",	"HALT",		"LD m,A",
+		"LD A,B",	"LD A,C",	"LD A,D",	"LD A,E",	"LD A,h",	"LD A,l",	"LD A,m",	"LD A,A",
+
+		"ADD A,B",	"ADD A,C",	"ADD A,D",	"ADD A,E",	"ADD A,h",	"ADD A,l",	"ADD A,m",	"ADD A,A",
+		"ADC A,B",	"ADC A,C",	"ADC A,D",	"ADC A,E",	"ADC A,h",	"ADC A,l",	"ADC A,m",	"ADC A,A",
+		"SUB B",	"SUB C",	"SUB D",	"SUB E",	"SUB h",	"SUB l",	"SUB m",	"SUB A",
+		"SBC A,B",	"SBC A,C",	"SBC A,D",	"SBC A,E",	"SBC A,h",	"SBC A,l",	"SBC A,m",	"SBC A,A",
+		"AND B",	"AND C",	"AND D",	"AND E",	"AND h",	"AND l",	"AND m",	"AND A",
+		"XOR B",	"XOR C",	"XOR D",	"XOR E",	"XOR h",	"XOR l",	"XOR m",	"XOR A",
+		"OR B",		"OR C",		"OR D",		"OR E",		"OR h",		"OR l",		"OR m",		"OR A",
+		"CP B",		"CP C",		"CP D",		"CP E",		"CP h",		"CP l",		"CP m",		"CP A",
+
+		"RET NZ",	"POP BC",	"JP NZ,w",	"JP w",		"CALL NZ,w",	"PUSH BC",	"ADD A,n",	"RST r",
+		"RET Z",	"RET",		"JP Z,w",	NULL,		"CALL Z,w",	"CALL w",	"ADC A,n",	"RST r",
+		"RET NC",	"POP DE",	"JP NC,w",	"OUT (n),A",	"CALL NC,w",	"PUSH DE",	"SUB n",	"RST r",
+		"RET C",	"EXX",		"JP C,w",	"IN A,(n)",	"CALL C,w",	NULL,		"SBC A,n",	"RST r",
+		"RET PO",	"POP x",	"JP PO,w",	"EX (SP),x",	"CALL PO,w",	"PUSH x",	"AND n",	"RST r",
+		"RET PE",	"JP (x)",	"JP PE,w",	"EX DE,HL",	"CALL PE,w",	NULL,		"XOR n",	"RST r",
+		"RET P",	"POP AF",	"JP P,w",	"DI",		"CALL P,w",	"PUSH AF",	"OR n",		"RST r",
+		"RET M",	"LD SP,x",	"JP M,w",	"EI",		"CALL M,w",	NULL,		"CP n",		"RST r"
+	};
+
+/**
+ * ED 40h to 7Fh (with the undocumented mirrors).
+ */
+	static constexpr const char* EXTENDED[64] = {
+		"IN B,(C)",	"OUT (C),B",	"SBC HL,BC",	"LD (w),BC",	"NEG",		"RETN",		"IM 0",		"LD I,A",
+		"IN C,(C)",	"OUT (C),C",	"ADC HL,BC",	"LD BC,(w)",	"NEG",		"RETI",		"IM 0",		"LD R,A",
+		"IN D,(C)",	"OUT (C),D",	"SBC HL,DE",	"LD (w),DE",	"NEG",		"RETN",		"IM 1",		"LD A,I",
+		"IN E,(C)",	"OUT (C),E",	"ADC HL,DE",	"LD DE,(w)",	"NEG",		"RETN",		"IM 2",		"LD A,R",
+		"IN H,(C)",	"OUT (C),H",	"SBC HL,HL",	"LD (w),HL",	"NEG",		"RETN",		"IM 0",		"RRD",
+		"IN L,(C)",	"OUT (C),L",	"ADC HL,HL",	"LD HL,(w)",	"NEG",		"RETN",		"IM 0",		"RLD",
+		"IN (C)",	"OUT (C),0",	"SBC HL,SP",	"LD (w),SP",	"NEG",		"RETN",		"IM 1",		NULL,
+		"IN A,(C)",	"OUT (C),A",	"ADC HL,SP",	"LD SP,(w)",	"NEG",		"RETN",		"IM 2",		NULL
+	};
+
+/**
+ * ED A0h to BFh: block instructions.
+ */
+	static constexpr const char* BLOCKS[32] = {
+		"LDI",		"CPI",		"INI",		"OUTI",		NULL,		NULL,		NULL,		NULL,
+		"LDD",		"CPD",		"IND",		"OUTD",		NULL,		NULL,		NULL,		NULL,
+		"LDIR",		"CPIR",		"INIR",		"OTIR",		NULL,		NULL,		NULL,		NULL,
+		"LDDR",		"CPDR",		"INDR",		"OTDR",		NULL,		NULL,		NULL,		NULL
+	};
+
+/**
+ * MAIN templates changed by an index prefix (using x, h, l or m).
+ */
+	static constexpr std::array<bool, 256> USES_HL = []() {
+		std::array<bool, 256> a {};
+		for (unsigned i = 0; i < 256; ++i) {
+			for (auto s = MAIN[i]; s && *s; ++s) {
+				if ((*s == 'x') || (*s == 'h') || (*s == 'l') || (*s == 'm')) a[i] = true;
+			}
+		}
+		return a;
+	}();
+};
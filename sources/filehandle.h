@@ -0,0 +1,804 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <mutex>
+#include <unordered_set>
+#include <cerrno>
+#include <vector>
+#include <iterator>
+#include <chrono>
+#include <algorithm>
+
+#include "textmode.h"
+#include "writepolicy.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#define FILEHANDLE_POSIX 1
+#endif
+
+/**
+ * Host file opened by the BDOS on behalf of a FCB.
+ * The handle owns the file position, counted in 128-byte records, and the file
+ * length. The BDOS syncs the FCB fields (CR, EX, S2, RC) from these values on
+ * every call ; the stream is only seeked when the position asked by the FCB
+ * differs from the current one, or when switching between reading & writing.
+ *
+ * Host file descriptors are shared by all the handles of the process within a
+ * budget (see setBudget), the streams & the control descriptors (see below).
+ * When the budget is exhausted, the least recently used handle is suspended:
+ * its descriptors are closed but its path, mode & length are kept, and it is
+ * reopened transparently on its next access.
+ *
+ * When locking is enabled (see setLocking), the handles of all the sessions &
+ * processes sharing a drive are coordinated with fcntl byte-range locks, taken
+ * on a descriptor kept by the handle:
+ *  * a mode byte beyond any CP/M file size is read-locked by every opener; an
+ *    exclusive opener upgrades it to a write lock on its first write, so only
+ *    one session can write a file unless all the writers opened it unlocked;
+ *  * a file opened unlocked accepts record locks (128-byte ranges). Locks
+ *    already held, and record locks on files opened in another mode, are
+ *    answered without any system call. A record written without holding its
+ *    lock is tested first (one fcntl), and refused if locked by another session.
+ * Linux open file description locks are used when available, so the sessions
+ * of one process are coordinated too. A handle holding record locks or the
+ * exclusive mode lock is never suspended; the others read-lock the mode byte
+ * again when resumed. Without these locks, no locking handle is suspended.
+ *
+ * A text file is translated (see TextMode) into a CP/M image kept in memory
+ * while opened, so records & size are consistent for random access. It does
+ * not hold any host descriptor until it is written back by close.
+ *
+ * Writes follow the policy of the drive (see WritePolicy): preallocation by
+ * extent with fallocate (Linux), holes for the records skipped by BDOS 40,
+ * and fsync never, on close or every N records. Preallocation & sync use the
+ * same descriptor as the locks; they are not available on Windows.
+ */
+class FileHandle {
+public:
+	FileHandle() = default;
+	FileHandle(const FileHandle&) = delete;
+	FileHandle& operator=(const FileHandle&) = delete;
+
+	~FileHandle() {
+		close();
+	}
+
+/**
+ * Sharing modes (MP/M II interface attributes F5' & F6').
+ */
+	enum class Share {
+		EXCLUSIVE,	// Default: shared reading, one writer
+		READ_ONLY,	// F6': no write
+		UNLOCKED	// F5': shared reading & writing, with record locks
+	};
+
+/**
+ * Enable the coordination of the handles with byte-range locks.
+ * @param aLocking true to enable.
+ */
+	static void setLocking(const bool aLocking) {
+		locking() = aLocking;
+	}
+
+/**
+ * @param aErrno Error number set by a failing operation.
+ * @return true if the error is caused by a lock held by another session.
+ */
+	static bool isConflict(const int aErrno) {
+		return (aErrno == EACCES) || (aErrno == EAGAIN);
+	}
+
+/**
+ * Set the number of host files opened at once by all the handles of the process.
+ * @param aBudget Number of file descriptors (at least 1).
+ */
+	static void setBudget(const unsigned aBudget) {
+		std::lock_guard<std::mutex> lock(lru().mutex);
+		lru().budget = aBudget ? aBudget : 1;
+	}
+
+/**
+ * Descriptors kept out of the budget when raising the process limit (standard
+ * streams, devices, log, server sockets...).
+ */
+	static constexpr unsigned RESERVED = 64;
+
+/**
+ * Set the budget from the command line, raising the soft limit of descriptors
+ * of the process when needed.
+ * @param aSpec Number of host files opened at once.
+ * @return false if invalid or beyond the hard limit.
+ */
+	static bool configure(const std::string& aSpec) {
+		char* end;
+		const auto n = strtoul(aSpec.c_str(), &end, 10);
+		if (aSpec.empty() || *end || !n || (n > 1000000)) {
+			std::cerr << ">> Invalid files budget \"" << aSpec << "\"!" << std::endl;
+			return false;
+		}
+#ifdef FILEHANDLE_POSIX
+		rlimit r;
+		const rlim_t needed = n + RESERVED;
+		if (!getrlimit(RLIMIT_NOFILE, &r) && (r.rlim_cur != RLIM_INFINITY) && (r.rlim_cur < needed)) {
+			r.rlim_cur = ((r.rlim_max == RLIM_INFINITY) || (r.rlim_max >= needed)) ? needed : r.rlim_max;
+			if ((r.rlim_cur < needed) || setrlimit(RLIMIT_NOFILE, &r)) {
+				std::cerr << ">> Files budget " << n << " beyond the descriptors limit (" << r.rlim_max << " - " << RESERVED << ")!" << std::endl;
+				return false;
+			}
+		}
+#endif
+		setBudget(n);
+		return true;
+	}
+
+/**
+ * @return the number of host descriptors currently opened by the handles.
+ */
+	static unsigned opened() {
+		std::lock_guard<std::mutex> lock(lru().mutex);
+		return lru().count;
+	}
+
+/**
+ * Record size (fixed to 128 for CP/M 2.2).
+ */
+	static constexpr auto RECORD_SIZE = 128U;
+
+/**
+ * Position value forcing the next seek.
+ */
+	static constexpr uint32_t UNKNOWN = UINT32_MAX;
+
+/**
+ * Open (or create) a host file.
+ * An existing file is opened read/write when possible, read-only otherwise.
+ * @param aPath Host path of the file.
+ * @param aCreate true to create (truncate) the file.
+ * @param aShare Sharing mode.
+ * @param aText true to translate a text file.
+ * @param aPolicy Write policy of the drive, NULL for none.
+ * @return true if the file is opened.
+ */
+	bool open(const std::string& aPath, const bool aCreate, const Share aShare = Share::EXCLUSIVE, const bool aText = false, WritePolicy *const aPolicy = NULL) {
+		close();
+		std::lock_guard<std::mutex> lock(mutex);
+		path = aPath;
+		share = aShare;
+		text = aText;
+		policy = aPolicy;
+		if (!aCreate && !openControl()) return false;	// lock before truncating!
+		reserve(1);
+		if (aCreate) {
+			stream.open(path, std::ios::binary|std::ios::in|std::ios::out|std::ios::trunc);
+			readOnly = false;
+		} else {
+			stream.open(path, std::ios::binary|std::ios::in|std::ios::out);
+			readOnly = !stream.is_open();
+			if (readOnly) stream.open(path, std::ios::binary|std::ios::in);
+		}
+		if (!stream || (aCreate && !openControl())) {
+			const auto e = errno;
+			stream.close();
+			closeControl();
+			errno = e;
+			return false;
+		}
+		if (share == Share::READ_ONLY) readOnly = true;
+
+		stream.seekg(0, std::ios::end);
+		length = stream.tellg();
+		stream.seekg(0);
+		position = 0;
+		writing = false;
+		active = true;
+		allocated = length;
+		unsynced = 0;
+
+		if (text) {		// Load the translated image & give the descriptor back
+			const std::vector<uint8_t> host((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+			TextMode::toCPM(host.data(), host.size(), image);
+			length = image.size();
+			dirty = aCreate;
+			stream.close();
+			settle();
+		}
+		return true;
+	}
+
+/**
+ * Close the host file.
+ * @return true if the file is closed.
+ */
+	bool close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		bool ok = true;
+		if (active && text && dirty) ok = writeBack();
+		if (active && policy && (policy->sync != WritePolicy::Sync::NEVER) && unsynced) ok = sync() && ok;
+		active = false;
+		if (stream.is_open()) stream.close();
+		if (!trim()) ok = false;
+		closeControl();
+		return ok && !stream.is_open();
+	}
+
+/**
+ * Lock a record for this handle (BDOS function 42).
+ * @param aRecord Record number.
+ * @return true if locked, false with errno set otherwise.
+ */
+	bool lock(const uint32_t aRecord) {
+		std::lock_guard<std::mutex> lock(mutex);
+#ifdef FILEHANDLE_POSIX
+		if (!locking() || (share != Share::UNLOCKED) || lockedRecords.count(aRecord)) return true;
+		if (!openControl()) return false;	// suspended
+		if (!setLock(off_t(aRecord) * RECORD_SIZE, RECORD_SIZE, F_WRLCK)) return false;
+		lockedRecords.insert(aRecord);
+#endif
+		return true;
+	}
+
+/**
+ * Unlock a record locked by this handle (BDOS function 43).
+ * @param aRecord Record number.
+ * @return true if unlocked, false with errno set otherwise.
+ */
+	bool unlock(const uint32_t aRecord) {
+		std::lock_guard<std::mutex> lock(mutex);
+#ifdef FILEHANDLE_POSIX
+		if ((fd < 0) || !lockedRecords.count(aRecord)) return true;
+		if (!setLock(off_t(aRecord) * RECORD_SIZE, RECORD_SIZE, F_UNLCK)) return false;
+		lockedRecords.erase(aRecord);
+#endif
+		return true;
+	}
+
+/**
+ * @return true if the file is opened, even if its host stream is suspended.
+ */
+	bool isOpen() const {
+		return active;
+	}
+
+	bool isReadOnly() const {
+		return readOnly;
+	}
+
+/**
+ * @return the number of records, the last one may be partial.
+ */
+	uint32_t records() const {
+		return (length + RECORD_SIZE - 1) / RECORD_SIZE;
+	}
+
+/**
+ * Read a record.
+ * @param aRecord Record number.
+ * @param aBuffer Buffer of RECORD_SIZE bytes.
+ * @return number of bytes read (less than RECORD_SIZE for the last record, 0 after end of file), -1 on error.
+ */
+	int read(const uint32_t aRecord, uint8_t aBuffer[]) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (uint64_t(aRecord) * RECORD_SIZE >= length) return 0;
+		if (text) {
+			memcpy(aBuffer, image.data() + size_t(aRecord) * RECORD_SIZE, RECORD_SIZE);
+			return RECORD_SIZE;
+		}
+		if (!resume() || !seek(aRecord, false)) return -1;
+
+		stream.read(reinterpret_cast<char*>(aBuffer), RECORD_SIZE);
+		const auto n = stream.gcount();
+		position = aRecord + 1;
+		if (!stream) {
+			position = UNKNOWN;		// not on a record boundary anymore
+			if (!stream.eof()) return -1;
+			stream.clear();			// partial last record
+		}
+		return n;
+	}
+
+/**
+ * Write a record, extending the file if needed.
+ * @param aRecord Record number.
+ * @param aBuffer Buffer of RECORD_SIZE bytes.
+ * @return true if written.
+ */
+	bool write(const uint32_t aRecord, const uint8_t aBuffer[]) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return writeRecord(aRecord, aBuffer);
+	}
+
+/**
+ * Write zeroed records from the end of file up to a record (excluded).
+ * @param aRecord First record not to be filled.
+ * @return true if written.
+ */
+	bool zeroFill(const uint32_t aRecord) {
+		static const uint8_t ZERO[RECORD_SIZE] = {};
+		std::lock_guard<std::mutex> lock(mutex);
+		if (aRecord <= records()) return true;
+		if (policy && policy->sparse) return true;	// holes read as zeros
+		if (policy) policy->zeroed += aRecord - records();
+		for (auto r = records(); r < aRecord; ++r) {
+			if (!writeRecord(r, ZERO)) return false;
+		}
+		return true;
+	}
+
+protected:
+/**
+ * Write a record, the handle being locked.
+ */
+	bool writeRecord(const uint32_t aRecord, const uint8_t aBuffer[]) {
+		if (text) {
+			if (readOnly || !acquireWrite(aRecord)) return false;
+			const auto offset = size_t(aRecord) * RECORD_SIZE;
+			if (offset + RECORD_SIZE > image.size()) image.resize(offset + RECORD_SIZE, 0);
+			memcpy(image.data() + offset, aBuffer, RECORD_SIZE);
+			length = image.size();
+			dirty = true;
+			return true;
+		}
+		if (readOnly || !acquireWrite(aRecord) || !resume() || !seek(aRecord, true)) return false;
+		if (policy) {
+			if (aRecord > records()) policy->holes += aRecord - records();
+			if (policy->preallocate) preallocate(uint64_t(aRecord + 1) * RECORD_SIZE);
+		}
+
+		stream.write(reinterpret_cast<const char*>(aBuffer), RECORD_SIZE);
+		if (!stream) {
+			position = UNKNOWN;
+			return false;
+		}
+		position = aRecord + 1;
+		if (uint64_t(position) * RECORD_SIZE > length) length = uint64_t(position) * RECORD_SIZE;
+		++unsynced;
+		if (policy && (policy->sync == WritePolicy::Sync::EVERY) && (unsynced >= policy->every)) return sync();
+		return true;
+	}
+
+/**
+ * Allocate the host blocks up to the end of the extent containing an offset.
+ * The handle is locked.
+ */
+	void preallocate(const uint64_t aEnd) {
+#if defined(FILEHANDLE_POSIX) && defined(FALLOC_FL_KEEP_SIZE)
+		if ((fd < 0) || (aEnd <= allocated)) return;
+		const uint64_t end = (aEnd + EXTENT_SIZE - 1) / EXTENT_SIZE * EXTENT_SIZE;
+		const uint64_t start = policy->sparse ? std::max(allocated, end - EXTENT_SIZE) : allocated;	// keep the holes
+		if (::fallocate(fd, FALLOC_FL_KEEP_SIZE, start, end - start) == 0) {
+			++policy->preallocations;
+			policy->preallocatedBytes += end - start;
+		}
+		allocated = end;	// do not retry on a file system without fallocate
+#endif
+	}
+
+/**
+ * Synchronize the file to the storage. The handle is locked.
+ * @return true if synchronized.
+ */
+	bool sync() {
+		unsynced = 0;
+		if (stream.is_open()) stream.flush();
+#ifdef FILEHANDLE_POSIX
+		if (fd < 0) return bool(stream);
+		const auto start = std::chrono::steady_clock::now();
+		const auto ok = ::fsync(fd) == 0;
+		++policy->syncs;
+		policy->syncNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		return ok && bool(stream);
+#else
+		return bool(stream);
+#endif
+	}
+
+/**
+ * Move the stream to a record when needed.
+ * @param aRecord Record number.
+ * @param aWrite true for the next operation being a write.
+ */
+	bool seek(const uint32_t aRecord, const bool aWrite) {
+		if ((aRecord != position) || (aWrite != writing)) {
+			stream.seekp(std::streamoff(aRecord) * RECORD_SIZE);
+			position = aRecord;
+			writing = aWrite;
+		}
+		return bool(stream);
+	}
+
+/**
+ * Translate back the image of a text file into the host file. The handle is locked.
+ * @return true if written.
+ */
+	bool writeBack() {
+		std::vector<uint8_t> host;
+		TextMode::toHost(image.data(), image.size(), host);
+		std::ofstream out(path, std::ios::binary|std::ios::out|std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(host.data()), host.size());
+		out.close();
+		dirty = false;
+		return bool(out);
+	}
+
+/**
+ * Reopen a suspended stream, or mark an opened one as most recently used.
+ * The handle is locked.
+ * @return true if the stream is opened.
+ */
+	bool resume() {
+		if (stream.is_open()) {
+			touch();
+			return true;
+		}
+		if (!openControl()) return false;
+		reserve(1);
+		stream.open(path, readOnly ? std::ios::binary|std::ios::in : std::ios::binary|std::ios::in|std::ios::out);
+		if (!stream) {
+			stream.close();
+			settle();
+			return false;
+		}
+		position = UNKNOWN;
+		return true;
+	}
+
+/**
+ * Suspend the handle to give its descriptors back to the budget: the records
+ * waiting for a sync are synchronized, the preallocated blocks given back and
+ * the locks released. The handle & the budget are locked.
+ */
+	void suspend() {
+		if (policy && (policy->sync != WritePolicy::Sync::NEVER) && unsynced) sync();
+		stream.close();
+		stream.clear();
+		trim();
+#ifdef FILEHANDLE_POSIX
+		if (fd >= 0) ::close(fd);
+		fd = -1;
+#endif
+	}
+
+/**
+ * Give back the host blocks preallocated beyond the end of the file, which
+ * may have been extended by another session. The stream is closed & the
+ * handle locked.
+ * @return true if done.
+ */
+	bool trim() {
+#ifdef FILEHANDLE_POSIX
+		if ((fd < 0) || (allocated <= length) || text) return true;
+		allocated = length;
+		struct stat st;
+		if (::fstat(fd, &st)) return false;
+		return ::ftruncate(fd, std::max<off_t>(length, st.st_size)) == 0;
+#else
+		return true;
+#endif
+	}
+
+/**
+ * Preallocation unit (a CP/M extent).
+ */
+	static constexpr uint64_t EXTENT_SIZE = 16384;
+
+/**
+ * Offset of the byte locked to share the file (beyond 8 MB, the CP/M 2.2 file size limit).
+ */
+	static constexpr long long MODE_OFFSET = 0x7FFFFFFFLL;
+
+	static bool& locking() {
+		static bool enabled = false;
+		return enabled;
+	}
+
+/**
+ * Open the control descriptor when locking is enabled or the write policy
+ * needs it, and read-lock the mode byte; nothing if already opened. The
+ * handle is locked.
+ * @return true if the file can be shared in the asked mode.
+ */
+	bool openControl() {
+#ifdef FILEHANDLE_POSIX
+		if ((fd >= 0) || (!locking() && !(policy && policy->needsDescriptor()))) return true;
+		reserve(1);
+		fd = ::open(path.c_str(), O_RDWR);
+		if (fd < 0) fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			const auto e = errno;
+			settle();
+			errno = e;
+			return false;
+		}
+		if (locking() && !setLock(MODE_OFFSET, 1, F_RDLCK)) {
+			const auto e = errno;
+			closeControl();
+			errno = e;
+			return false;
+		}
+#endif
+		return true;
+	}
+
+/**
+ * Check that this handle may write a record: upgrade the mode byte lock for
+ * an exclusive writer, or test the record lock for a file opened unlocked.
+ * The handle is locked.
+ * @return true if this handle may write, false with errno set otherwise.
+ */
+	bool acquireWrite(const uint32_t aRecord) {
+#ifdef FILEHANDLE_POSIX
+		if (!locking() || exclusive) return true;
+		if (!openControl()) return false;	// suspended
+		if (share == Share::UNLOCKED) return lockedRecords.count(aRecord) || !isLocked(off_t(aRecord) * RECORD_SIZE, RECORD_SIZE);
+		if (share != Share::EXCLUSIVE) return true;
+		if (!setLock(MODE_OFFSET, 1, F_WRLCK)) return false;
+		exclusive = true;
+#endif
+		return true;
+	}
+
+/**
+ * Close the control descriptor, releasing all the locks of the handle. The handle is locked.
+ */
+	void closeControl() {
+#ifdef FILEHANDLE_POSIX
+		if (fd >= 0) ::close(fd);
+		fd = -1;
+		lockedRecords.clear();
+		exclusive = false;
+#endif
+		settle();
+	}
+
+#ifdef FILEHANDLE_POSIX
+/**
+ * Set a byte-range lock without waiting.
+ */
+	bool setLock(const off_t aStart, const off_t aLength, const short aType) {
+		struct flock fl = {};
+		fl.l_type = aType;
+		fl.l_whence = SEEK_SET;
+		fl.l_start = aStart;
+		fl.l_len = aLength;
+#ifdef F_OFD_SETLK
+		return ::fcntl(fd, F_OFD_SETLK, &fl) == 0;
+#else
+		return ::fcntl(fd, F_SETLK, &fl) == 0;
+#endif
+	}
+
+/**
+ * Test a byte-range write lock.
+ * @return true, with errno set to EACCES, if another session holds a lock on
+ *         the range (false on error too, with errno set).
+ */
+	bool isLocked(const off_t aStart, const off_t aLength) {
+		struct flock fl = {};
+		fl.l_type = F_WRLCK;
+		fl.l_whence = SEEK_SET;
+		fl.l_start = aStart;
+		fl.l_len = aLength;
+#ifdef F_OFD_GETLK
+		if (::fcntl(fd, F_OFD_GETLK, &fl)) return true;
+#else
+		if (::fcntl(fd, F_GETLK, &fl)) return true;
+#endif
+		if (fl.l_type == F_UNLCK) return false;
+		errno = EACCES;
+		return true;
+	}
+#endif
+
+/**
+ * Handle that can't be suspended: it holds locks that could be taken by
+ * another session meanwhile, or closing any descriptor of a file releases the
+ * process locks on it when open file description locks are not available.
+ */
+	bool pinned() const {
+#if defined(FILEHANDLE_POSIX) && defined(F_OFD_SETLK)
+		return exclusive || !lockedRecords.empty();
+#elif defined(FILEHANDLE_POSIX)
+		return (fd >= 0) && locking();
+#else
+		return false;
+#endif
+	}
+
+/**
+ * Process-wide list of the handles holding descriptors, most recently used
+ * first, and the number of descriptors they hold.
+ */
+	struct LRU {
+		std::mutex mutex;
+		FileHandle* head = nullptr;
+		FileHandle* tail = nullptr;
+		unsigned count = 0;
+		unsigned budget = 64;
+	};
+
+	static LRU& lru() {
+		static LRU list;
+		return list;
+	}
+
+/**
+ * Count descriptors about to be opened by the handle, inserting it in the LRU
+ * list and suspending the least recently used ones when the budget is
+ * exhausted. Busy handles (used by another thread) are skipped.
+ * The handle is locked.
+ */
+	void reserve(const unsigned aDescriptors) {
+		auto& l = lru();
+		std::lock_guard<std::mutex> lock(l.mutex);
+		for (auto h = l.tail; h && (l.count + aDescriptors > l.budget); ) {
+			const auto prev = h->prev;
+			if ((h != this) && !h->pinned() && h->mutex.try_lock()) {
+				h->suspend();
+				h->remove(l);
+				h->mutex.unlock();
+			}
+			h = prev;
+		}
+		if (!linked) insert(l);
+		held += aDescriptors;
+		l.count += aDescriptors;
+	}
+
+/**
+ * Count again the descriptors held after some were closed (or failed to
+ * open), removing the handle from the LRU list when none is left.
+ * The handle is locked.
+ */
+	void settle() {
+		auto& l = lru();
+		std::lock_guard<std::mutex> lock(l.mutex);
+		if (!linked) return;
+		l.count -= held;
+		held = (stream.is_open() ? 1 : 0) + ((fd >= 0) ? 1 : 0);
+		l.count += held;
+		if (!held) remove(l);
+	}
+
+/**
+ * Move the handle at the head of the LRU list. The handle is locked.
+ */
+	void touch() {
+		auto& l = lru();
+		std::lock_guard<std::mutex> lock(l.mutex);
+		if (l.head != this) {
+			remove(l);
+			insert(l);
+		}
+	}
+
+	void insert(LRU& l) {
+		prev = nullptr;
+		next = l.head;
+		if (l.head) l.head->prev = this; else l.tail = this;
+		l.head = this;
+		linked = true;
+	}
+
+	void remove(LRU& l) {
+		if (!linked) return;
+		if (prev) prev->next = next; else l.head = next;
+		if (next) next->prev = prev; else l.tail = prev;
+		prev = next = nullptr;
+		linked = false;
+		l.count -= held;
+		held = 0;
+	}
+
+private:
+/**
+ * Host path, kept for diagnostics.
+ */
+	std::string path;
+
+/**
+ * Host stream.
+ */
+	std::fstream stream;
+
+/**
+ * Current position of the stream, in records.
+ */
+	uint32_t position = 0;
+
+/**
+ * File length, in bytes.
+ */
+	uint64_t length = 0;
+
+/**
+ * Last operation was a write (the stream needs a seek before switching).
+ */
+	bool writing = false;
+
+/**
+ * File opened read-only.
+ */
+	bool readOnly = false;
+
+/**
+ * File opened by the BDOS (its stream may be suspended).
+ */
+	bool active = false;
+
+/**
+ * Sharing mode.
+ */
+	Share share = Share::EXCLUSIVE;
+
+/**
+ * Translated text file, its CP/M image & whether the image was written.
+ */
+	bool text = false;
+	std::vector<uint8_t> image;
+	bool dirty = false;
+
+/**
+ * Control descriptor, holding the byte-range locks, used for preallocation &
+ * sync (-1 if none).
+ */
+	int fd = -1;
+
+/**
+ * Write policy of the drive (NULL for none), host bytes allocated & records
+ * written since the last sync.
+ */
+	WritePolicy* policy = NULL;
+	uint64_t allocated = 0;
+	unsigned unsynced = 0;
+
+/**
+ * Mode byte write-locked.
+ */
+	bool exclusive = false;
+
+/**
+ * Records locked by this handle.
+ */
+	std::unordered_set<uint32_t> lockedRecords;
+
+/**
+ * Lock of the handle, against the eviction by another thread.
+ */
+	std::mutex mutex;
+
+/**
+ * Links in the LRU list.
+ */
+	FileHandle* prev = nullptr;
+	FileHandle* next = nullptr;
+	bool linked = false;
+
+/**
+ * Descriptors counted in the budget.
+ */
+	unsigned held = 0;
+};
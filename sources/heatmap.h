@@ -0,0 +1,207 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <cctype>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/**
+ * Memory heat map: reads (instruction fetches included), writes & executions
+ * (instruction starts) of every address, counted by all the machines. At exit
+ * the counters are written in the heat map file:
+ * - a ".png" file gets a 256x256 image, an address by pixel (row: high byte,
+ *   column: low byte), reads in red, writes in green & executions in blue, on
+ *   a logarithmic scale;
+ * - another file gets the counters: "CPMHEAT" & a version byte, then the 64K
+ *   reads, writes & executions, 32-bit little endian (saturated).
+ * The machines only use the counting memory callbacks when the heat map is
+ * configured, so it costs nothing otherwise.
+ */
+class HeatMap {
+public:
+	enum Access { READ, WRITE, EXECUTE };
+
+/**
+ * Accesses by kind & address.
+ */
+	struct Counters {
+		uint64_t counts[3][0x10000];
+	};
+
+/**
+ * Count the memory accesses.
+ * @param aPath Heat map file, truncated & written at exit.
+ * @return false if the file can't be created.
+ */
+	static bool configure(const std::string& aPath) {
+		std::ofstream fs(aPath, std::ios::binary | std::ios::trunc);
+		if (!fs) {
+			std::cerr << ">> Error creating heat map file \"" << aPath << "\"!" << std::endl;
+			return false;
+		}
+		auto& s = settings();
+		s.path = aPath;
+		auto extension = aPath.substr(std::min(aPath.rfind('.'), aPath.size()));
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		s.png = (extension == ".png");
+		return true;
+	}
+
+/**
+ * @param aTop End of the programs area (TPA), for the report.
+ * @return the counters of a machine if configured, or NULL.
+ */
+	static Counters* create(const uint16_t aTop) {
+		auto& s = settings();
+		if (s.path.empty()) return NULL;
+		if (!s.counters) {
+			s.counters = new Counters();
+			std::atexit(write);
+		}
+		s.top = aTop;
+		return s.counters;
+	}
+
+/**
+ * Print out the use of the programs area: bytes used, read, written &
+ * executed, and the code written (bytes executed & written).
+ */
+	static void report(std::ostream& aOut) {
+		const auto& s = settings();
+		if (!s.counters) return;
+		const auto& c = s.counters->counts;
+		unsigned read = 0, written = 0, executed = 0, modified = 0, used = 0;
+		for (unsigned addr = 0x0100; addr < s.top; ++addr) {
+			if (c[READ][addr]) ++read;
+			if (c[WRITE][addr]) ++written;
+			if (c[EXECUTE][addr]) ++executed;
+			if (c[WRITE][addr] && c[EXECUTE][addr]) ++modified;
+			if (c[READ][addr] || c[WRITE][addr]) ++used;
+		}
+		aOut << "Heat map: TPA " << s.top - 0x0100 << " bytes, " << used << " used (" << read << " read, " << written << " written, "
+			 << executed << " executed), " << modified << " of code written" << std::endl;
+	}
+
+protected:
+	static void write() {
+		const auto& s = settings();
+		std::ofstream fs(s.path, std::ios::binary | std::ios::trunc);
+		if (s.png) writePNG(fs, s.counters->counts);
+		else writeCounters(fs, s.counters->counts);
+	}
+
+	static void writeCounters(std::ostream& aOut, const uint64_t aCounters[3][0x10000]) {
+		aOut.write("CPMHEAT\x01", 8);
+		std::vector<uint8_t> buffer(4 * 0x10000);
+		for (unsigned a = 0; a < 3; ++a) {
+			const auto access = aCounters[a];
+			for (unsigned addr = 0; addr < 0x10000; ++addr) {
+				const uint32_t v = uint32_t(std::min<uint64_t>(access[addr], UINT32_MAX));
+				for (unsigned i = 0; i < 4; ++i) buffer[4 * addr + i] = uint8_t(v >> (8 * i));
+			}
+			aOut.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+		}
+	}
+
+/**
+ * Write a 256x256 RGB image, in stored (not compressed) deflate blocks.
+ */
+	static void writePNG(std::ostream& aOut, const uint64_t aCounters[3][0x10000]) {
+		double scale[3];
+		for (unsigned a = 0; a < 3; ++a) {
+			const auto max = *std::max_element(aCounters[a], aCounters[a] + 0x10000);
+			scale[a] = (max > 1) ? 191.0 / std::log(double(max)) : 0.0;
+		}
+		std::vector<uint8_t> image;
+		for (unsigned y = 0; y < 256; ++y) {
+			image.push_back(0);		// filter: none
+			for (unsigned x = 0; x < 256; ++x) {
+				for (unsigned a = 0; a < 3; ++a) {
+					const auto n = aCounters[a][y * 256 + x];
+					image.push_back(n ? uint8_t(64 + std::log(double(n)) * scale[a]) : 0);
+				}
+			}
+		}
+
+		std::vector<uint8_t> zlib { 0x78, 0x01 };
+		for (size_t i = 0; i < image.size(); i += 0xFFFF) {
+			const auto n = std::min<size_t>(image.size() - i, 0xFFFF);
+			zlib.push_back((i + n == image.size()) ? 1 : 0);
+			for (const auto v : { n, n ^ 0xFFFF }) {
+				zlib.push_back(uint8_t(v));
+				zlib.push_back(uint8_t(v >> 8));
+			}
+			zlib.insert(zlib.end(), image.begin() + i, image.begin() + i + n);
+		}
+		uint32_t s1 = 1, s2 = 0;		// Adler-32
+		for (const auto v : image) {
+			s1 = (s1 + v) % 65521;
+			s2 = (s2 + s1) % 65521;
+		}
+		append(zlib, (s2 << 16) | s1);
+
+		aOut.write("\x89PNG\r\n\x1A\n", 8);
+		std::vector<uint8_t> header;
+		append(header, 256);
+		append(header, 256);
+		header.insert(header.end(), { 8, 2, 0, 0, 0 });		// 8 bits RGB, deflate, no filter, not interlaced
+		chunk(aOut, "IHDR", header);
+		chunk(aOut, "IDAT", zlib);
+		chunk(aOut, "IEND", std::vector<uint8_t>());
+	}
+
+/**
+ * Append a 32-bit big endian value.
+ */
+	static void append(std::vector<uint8_t>& aData, const uint32_t aValue) {
+		for (int i = 24; i >= 0; i -= 8) aData.push_back(uint8_t(aValue >> i));
+	}
+
+	static void chunk(std::ostream& aOut, const char aType[4], const std::vector<uint8_t>& aData) {
+		std::vector<uint8_t> c;
+		append(c, aData.size());
+		c.insert(c.end(), aType, aType + 4);
+		c.insert(c.end(), aData.begin(), aData.end());
+		uint32_t crc = 0xFFFFFFFF;
+		for (size_t i = 4; i < c.size(); ++i) {
+			crc ^= c[i];
+			for (unsigned k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+		append(c, crc ^ 0xFFFFFFFF);
+		aOut.write(reinterpret_cast<const char*>(c.data()), c.size());
+	}
+
+private:
+	struct Settings {
+		std::string path;
+		bool png = false;
+		Counters* counters = NULL;
+		uint16_t top = 0;
+	};
+
+	static Settings& settings() {
+		static Settings s;
+		return s;
+	}
+};
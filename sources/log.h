@@ -0,0 +1,287 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <csignal>
+#define LOG_POSIX 1
+#else
+#include <io.h>
+#endif
+
+/**
+ * Asynchronous log: the diagnostics (std::clog & std::cerr) and the BDOS calls
+ * trace are written in a file by a background thread, so a slow storage does
+ * not stall the machine.
+ * The emulation thread (the only writer) formats each line and copies it into
+ * a ring buffer; the writer thread takes them by batches, every few
+ * milliseconds or when the ring is half full. When the ring is full, a line is
+ * dropped and counted, or the emulation waits for room (see configure).
+ * The writer thread blocks the asynchronous signals, so they are delivered to
+ * the emulation thread (or taken by the server signalfd).
+ */
+class Log : public std::streambuf {
+public:
+	static constexpr size_t BUFFER_SIZE = 1 << 20;
+	static constexpr std::chrono::milliseconds PERIOD { 50 };
+
+	enum class Overflow { DROP, BLOCK };
+
+/**
+ * Log in a file.
+ * @param aSpec "FILE[@drop|@block]": log file, truncated, and what to do when
+ *        the buffer is full (drop by default).
+ * @return false if the policy is invalid or the file can't be created.
+ */
+	static bool configure(const std::string& aSpec) {
+		const auto at = aSpec.rfind('@');
+		auto& s = settings();
+		s.overflow = Overflow::DROP;
+		if (at != std::string::npos) {
+			const auto policy = aSpec.substr(at + 1);
+			if (policy == "block") {
+				s.overflow = Overflow::BLOCK;
+			} else if (policy != "drop") {
+				std::cerr << ">> Invalid log policy \"" << policy << "\"!" << std::endl;
+				return false;
+			}
+		}
+		const auto path = aSpec.substr(0, at);
+#ifdef LOG_POSIX
+		s.fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#else
+		s.fd = ::_open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#endif
+		if (s.fd < 0) {
+			std::cerr << ">> Error creating log file \"" << path << "\"!" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+/**
+ * Start the configured log, once: std::clog & std::cerr are written in it
+ * until the end of the process.
+ */
+	static void start() {
+		auto& s = settings();
+		if ((s.fd < 0) || active()) return;
+		active() = new Log(s.fd, s.overflow);
+		s.fd = -1;
+		std::atexit(stop);
+	}
+
+/**
+ * @return true if the BDOS calls are traced into the log.
+ */
+	static bool enabled() {
+		return active() != NULL;
+	}
+
+	Log(const Log&) = delete;
+	Log& operator=(const Log&) = delete;
+
+protected:
+	Log(const int aFd, const Overflow aOverflow) :
+		fd(aFd),
+		policy(aOverflow),
+		ring(new char[BUFFER_SIZE]),
+		clog(std::clog.rdbuf(this)),
+		cerr(std::cerr.rdbuf(this)) {
+#ifdef LOG_POSIX
+		sigset_t signals, saved;
+		sigfillset(&signals);
+		for (const auto sig : { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGTRAP }) sigdelset(&signals, sig);
+		pthread_sigmask(SIG_BLOCK, &signals, &saved);	// inherited by the writer
+		writer = std::thread(&Log::drain, this);
+		pthread_sigmask(SIG_SETMASK, &saved, NULL);
+#else
+		writer = std::thread(&Log::drain, this);
+#endif
+	}
+
+/**
+ * Write out the last lines, stop the writer and print out the dropped lines.
+ */
+	~Log() {
+		if (!line.empty()) {
+			if (line.back() != '\n') line.push_back('\n');
+			push(line.data(), line.size());
+		}
+		std::clog.rdbuf(clog);
+		std::cerr.rdbuf(cerr);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		ready.notify_one();
+		writer.join();
+#ifdef LOG_POSIX
+		::close(fd);
+#else
+		::_close(fd);
+#endif
+		delete[] ring;
+		if (dropped) std::cerr << "Log: " << dropped << " lines dropped (buffer full)" << std::endl;
+	}
+
+	static void stop() {
+		delete active();
+		active() = NULL;
+	}
+
+/**
+ * Streambuf: the characters are kept until the end of the line.
+ */
+	int_type overflow(const int_type c) override {
+		if (c != traits_type::eof()) line.push_back(traits_type::to_char_type(c));
+		return traits_type::not_eof(c);
+	}
+
+	std::streamsize xsputn(const char* aString, const std::streamsize aLength) override {
+		line.append(aString, aLength);
+		return aLength;
+	}
+
+/**
+ * Streambuf flush (std::endl, or each std::cerr output): queue the complete
+ * lines.
+ */
+	int sync() override {
+		const auto end = line.rfind('\n');
+		if (end != std::string::npos) {
+			push(line.data(), end + 1);
+			line.erase(0, end + 1);
+		}
+		return 0;
+	}
+
+/**
+ * Copy lines into the ring, waking up the writer when it is half full.
+ */
+	void push(const char* aString, const size_t aLength) {
+		if (aLength > BUFFER_SIZE) {
+			dropped += std::count(aString, aString + aLength, '\n');
+			return;
+		}
+		const auto h = head.load(std::memory_order_relaxed);
+		while (BUFFER_SIZE - (h - tail.load(std::memory_order_acquire)) < aLength) {
+			ready.notify_one();
+			if (policy == Overflow::DROP) {
+				dropped += std::count(aString, aString + aLength, '\n');
+				return;
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			room.wait_for(lock, PERIOD, [this, h, aLength]() {
+				return BUFFER_SIZE - (h - tail.load(std::memory_order_acquire)) >= aLength;
+			});
+		}
+		const auto p = h % BUFFER_SIZE;
+		const auto n = std::min(aLength, BUFFER_SIZE - p);
+		memcpy(ring + p, aString, n);
+		memcpy(ring, aString + n, aLength - n);
+		head.store(h + aLength, std::memory_order_release);
+		if (h + aLength - tail.load(std::memory_order_relaxed) >= BUFFER_SIZE / 2) ready.notify_one();
+	}
+
+/**
+ * Writer thread: write out what is queued, then sleep a period.
+ */
+	void drain() {
+		while (true) {
+			const auto t = tail.load(std::memory_order_relaxed);
+			const auto h = head.load(std::memory_order_acquire);
+			if (h == t) {
+				std::unique_lock<std::mutex> lock(mutex);
+				if (stopping && (head.load(std::memory_order_acquire) == t)) return;
+				ready.wait_for(lock, PERIOD);
+				continue;
+			}
+			const auto p = t % BUFFER_SIZE;
+			const auto n = std::min(h - t, uint64_t(BUFFER_SIZE - p));
+			put(ring + p, n);
+			put(ring, h - t - n);
+			tail.store(h, std::memory_order_release);
+			if (policy == Overflow::BLOCK) room.notify_one();
+		}
+	}
+
+	void put(const char* aData, size_t aLength) const {
+		while (aLength) {
+#ifdef LOG_POSIX
+			const auto w = ::write(fd, aData, aLength);
+#else
+			const auto w = ::_write(fd, aData, unsigned(aLength));
+#endif
+			if (w <= 0) return;
+			aData += w;
+			aLength -= w;
+		}
+	}
+
+private:
+	struct Settings {
+		int fd = -1;
+		Overflow overflow = Overflow::DROP;
+	};
+
+	static Settings& settings() {
+		static Settings s;
+		return s;
+	}
+
+	static Log*& active() {
+		static Log* l = NULL;
+		return l;
+	}
+
+	const int fd;
+	const Overflow policy;
+
+/**
+ * Lines queued from tail to head (free running), and the current line.
+ */
+	char *const ring;
+	std::atomic<uint64_t> head { 0 };
+	std::atomic<uint64_t> tail { 0 };
+	std::string line;
+	uint64_t dropped = 0;
+
+	std::streambuf *const clog;
+	std::streambuf *const cerr;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::condition_variable room;
+	bool stopping = false;
+};
@@ -14,9 +14,8 @@
  * limitations under the License.
  */
 
-#define LOG		1
-
 #include "computer.h"
+#include "server.h"
 
 #include <iostream>
 
@@ -27,37 +26,193 @@
 
 #include <fstream>
 #include <exception>
+#include <vector>
+#include <string>
+
+/**
+ * Opcode mix (--opcodes), only built with -D OPCODE_MIX=1 as it slows every
+ * instruction down.
+ */
+#ifndef OPCODE_MIX
+#define OPCODE_MIX 0
+#endif
+
+/**
+ * Emulated machine: 64 KB, BDOS at FC00h & BIOS at FE00h.
+ */
+typedef Computer<64, 0xFC00, 0xFE00, OPCODE_MIX> Machine;
+
+/**
+ * Print out the command line usage.
+ */
+void usage(const char* aName) {
+	std::cerr << "Usage: " << aName << " [options] [program.com]" << std::endl;
+	std::cerr << "  --asciicast=FILE   convert the session record FILE into asciicast on the standard output" << std::endl;
+	std::cerr << "  --calls=FILE       count the BDOS & BIOS calls (bytes, host time, latencies) in FILE at exit & on SIGUSR1" << std::endl;
+	std::cerr << "  --capture=FILE     write the console output in FILE" << std::endl;
+	std::cerr << "  --decode=FILE      decode the instruction trace FILE on the standard output" << std::endl;
+	std::cerr << "  --files=N          open at most N host files at once (64), the least recently used ones are suspended" << std::endl;
+	std::cerr << "  --flamegraph=FILE  follow the calls, cycles by call stack in FILE at exit (collapsed stacks)" << std::endl;
+	std::cerr << "  --heatmap=FILE     count the reads, writes & executions of every address, in FILE at exit (.png image or counters)" << std::endl;
+	std::cerr << "  --list=DEVICE      list device (LPT:): FILE, |COMMAND, unix:PATH or tcp:HOST:PORT" << std::endl;
+	std::cerr << "  --log=FILE[@P]     write the diagnostics & BDOS calls in FILE from a thread, P: drop (full buffer) or block" << std::endl;
+	std::cerr << "  --locking          coordinate files shared with other sessions (record locks)" << std::endl;
+	std::cerr << "  --metrics=FILE[@S] rewrite live metrics (Prometheus text) in FILE every S seconds (5) and when idle" << std::endl;
+	std::cerr << "  --opcodes=FILE     count the opcodes, pairs & triples executed in FILE at exit, CSV or .json (OPCODE_MIX build)" << std::endl;
+	std::cerr << "  --profile=FILE[@P] sample the PC every P cycles (10007) or at P Hz (e.g. 1000hz), hot spots in FILE at exit" << std::endl;
+	std::cerr << "  --punch=DEVICE     punch device (PTP:), as --list" << std::endl;
+	std::cerr << "  --reader=DEVICE    reader device (PTR:), as --list" << std::endl;
+	std::cerr << "  --record=FILE      record the console session (output, input & timings) in FILE" << std::endl;
+	std::cerr << "  --screen=CxR[@F]   render a C columns, R rows virtual screen at most F frames per second" << std::endl;
+	std::cerr << "  --script=FILE      type the console input from FILE (expect/send/sendline commands)" << std::endl;
+	std::cerr << "  --symbols=FILE     read the symbols of FILE (.SYM, .PRN/.LST listing or \"addr name\" pairs)" << std::endl;
+	std::cerr << "  --terminal=TYPE    translate the escape sequences of terminal TYPE (adm3a, vt52, none) into ANSI" << std::endl;
+	std::cerr << "  --server=PATH      serve a session to each connection on the Unix socket PATH" << std::endl;
+	std::cerr << "  --trace=FILE[@N]   keep the last N instructions (65536) and dump them in FILE on SIGUSR2, error or crash" << std::endl;
+	std::cerr << "  --text=LIST        translate text files of drives (B:) or types (TXT), comma separated" << std::endl;
+	std::cerr << "  --write=D:POLICY   write policy of drives D: prealloc, sparse, sync=never|close|N (comma separated)" << std::endl;
+}
 
 int main(int argc, char** argv) {
 
-#ifdef LOG
-	std::filesystem::path path(argv[0]);
-	std::ofstream out(path.stem().string() + ".log");
-	auto old_rdbuf = std::clog.rdbuf();
-	std::clog.rdbuf(out.rdbuf());
-#endif
+	std::vector<std::string> args;
+	std::string server;
+	std::string decode;
+	std::string opcodes;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg(argv[i]);
+		if (arg.rfind("--asciicast=", 0) == 0) {
+			return Recorder::convert(arg.substr(12), std::cout) ? EXIT_SUCCESS : EXIT_FAILURE;
+		} else if (arg.rfind("--calls=", 0) == 0) {
+			if (!Calls::configure(arg.substr(8))) return EXIT_FAILURE;
+		} else if (arg.rfind("--capture=", 0) == 0) {
+			if (!Console::setCapture(arg.substr(10))) return EXIT_FAILURE;
+		} else if (arg.rfind("--decode=", 0) == 0) {
+			decode = arg.substr(9);
+		} else if (arg.rfind("--files=", 0) == 0) {
+			if (!FileHandle::configure(arg.substr(8))) return EXIT_FAILURE;
+		} else if (arg.rfind("--flamegraph=", 0) == 0) {
+			if (!CallStack::configure(arg.substr(13))) return EXIT_FAILURE;
+		} else if (arg.rfind("--heatmap=", 0) == 0) {
+			if (!HeatMap::configure(arg.substr(10))) return EXIT_FAILURE;
+		} else if (arg.rfind("--list=", 0) == 0) {
+			if (!Devices::assign(Devices::LIST, arg.substr(7))) return EXIT_FAILURE;
+		} else if (arg.rfind("--log=", 0) == 0) {
+			if (!Log::configure(arg.substr(6))) return EXIT_FAILURE;
+		} else if (arg == "--locking") {
+			FileHandle::setLocking(true);
+		} else if (arg.rfind("--metrics=", 0) == 0) {
+			if (!Metrics::configure(arg.substr(10))) return EXIT_FAILURE;
+		} else if (arg.rfind("--opcodes=", 0) == 0) {
+			if (!OPCODE_MIX) {
+				std::cerr << ">> Opcode mix not built in, compile with -D OPCODE_MIX=1!" << std::endl;
+				return EXIT_FAILURE;
+			}
+			opcodes = arg.substr(10);
+		} else if (arg.rfind("--profile=", 0) == 0) {
+			if (!Profile::configure(arg.substr(10))) return EXIT_FAILURE;
+		} else if (arg.rfind("--punch=", 0) == 0) {
+			if (!Devices::assign(Devices::PUNCH, arg.substr(8))) return EXIT_FAILURE;
+		} else if (arg.rfind("--reader=", 0) == 0) {
+			if (!Devices::assign(Devices::READER, arg.substr(9))) return EXIT_FAILURE;
+		} else if (arg.rfind("--record=", 0) == 0) {
+			if (!Recorder::configure(arg.substr(9))) return EXIT_FAILURE;
+		} else if (arg.rfind("--screen=", 0) == 0) {
+			if (!Screen::configure(arg.substr(9))) {
+				std::cerr << "Invalid screen '" << arg.substr(9) << "'!" << std::endl;
+				return EXIT_FAILURE;
+			}
+		} else if (arg.rfind("--script=", 0) == 0) {
+			if (!Console::setScript(arg.substr(9))) return EXIT_FAILURE;
+		} else if (arg.rfind("--server=", 0) == 0) {
+			server = arg.substr(9);
+		} else if (arg.rfind("--symbols=", 0) == 0) {
+			if (!Symbols::load(arg.substr(10))) return EXIT_FAILURE;
+		} else if (arg.rfind("--terminal=", 0) == 0) {
+			Terminal::Type type;
+			if (!Terminal::parse(arg.substr(11), type)) {
+				std::cerr << "Invalid terminal '" << arg.substr(11) << "'!" << std::endl;
+				return EXIT_FAILURE;
+			}
+			Console::setTerminal(type);
+		} else if (arg.rfind("--trace=", 0) == 0) {
+			if (!Trace::configure(arg.substr(8))) return EXIT_FAILURE;
+		} else if (arg.rfind("--text=", 0) == 0) {
+			if (!TextMode::configure(arg.substr(7))) {
+				std::cerr << "Invalid text files list '" << arg.substr(7) << "'!" << std::endl;
+				return EXIT_FAILURE;
+			}
+		} else if (arg.rfind("--write=", 0) == 0) {
+			if (!WritePolicy::configure(arg.substr(8))) {
+				std::cerr << "Invalid write policy '" << arg.substr(8) << "'!" << std::endl;
+				return EXIT_FAILURE;
+			}
+		} else if (arg.rfind("--", 0) == 0) {
+			std::cerr << "Invalid option '" << arg << "'!" << std::endl;
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		} else {
+			args.push_back(arg);
+		}
+	}
+
+	if (!decode.empty()) {
+		std::vector<Trace::Entry> entries;
+		if (!Trace::load(decode, entries)) return EXIT_FAILURE;
+		Machine::decode(entries, std::cout);
+		return EXIT_SUCCESS;
+	}
+
+	if (!opcodes.empty() && !OpcodeMix::configure(opcodes, args.empty() ? "CCP" : args[0])) return EXIT_FAILURE;
+
+	Log::start();
+	Profile::start();
+	Calls::start();
+
+	if (!server.empty()) {
+		if (args.size() > 1) {
+			std::cerr << "Invalid number of arguments!" << std::endl;
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		Server<Machine> s(server, args.empty() ? "" : args[0]);
+		const auto ok = s.run();
+		WritePolicy::report(std::cerr);
+		Screen::report(std::cerr);
+		HeatMap::report(std::cerr);
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 	
 	try {
-		Computer<64, 0xFC00, 0xFE00> computer;
-		switch (argc) {
-			case 1:
+		Machine computer;
+		switch (args.size()) {
+			case 0:
 				while (true) {
 					computer.init("CCP-DR.64K", 0xF400);
 //					computer.load("CPM.SYS", 0x3400 + 0xA800);
 					computer.run(0xF400);
 				}
 				break;
-			case 2:
-				computer.init(argv[1], 0x0100);
+			case 1:
+				computer.init(args[0], 0x0100);
 				computer.run(0x0100);
 				break;
 			default:
 				std::cerr << "Invalid number of arguments!" << std::endl;
+				usage(argv[0]);
 				return EXIT_FAILURE;
 		}
+	} catch (Console::Closed&) {
+		// End of the redirected input or of the script
 	} catch (std::exception& e) {
 		std::cerr << "Exception " << e.what() << std::endl;
+		WritePolicy::report(std::cerr);
+		Screen::report(std::cerr);
+		HeatMap::report(std::cerr);
 		return EXIT_FAILURE;
 	}
+	WritePolicy::report(std::cerr);
+	Screen::report(std::cerr);
+	HeatMap::report(std::cerr);
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,236 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "filehandle.h"
+
+/**
+ * Live metrics of the machines, in the Prometheus text format, in a file
+ * rewritten every few seconds while the machines run (e.g. for the textfile
+ * collector of node_exporter). A running machine shows its counters growing,
+ * an idle one its wait: the file is written at once when a machine it shows
+ * running starts waiting for the console input, other waits (a line being
+ * typed...) are written at the next period.
+ * Each machine keeps its own counters, with plain increments, and the other
+ * ones (instructions, console bytes...) are copied from every live machine by
+ * its refresh callback when the file is written: all the machines run on the
+ * same thread, so nothing is shared with another one.
+ */
+class Metrics {
+public:
+	static constexpr unsigned DEFAULT_PERIOD = 5;		// seconds
+
+/**
+ * Counters of a machine.
+ */
+	struct Machine {
+		unsigned id;
+		void (*refresh)(void* aOwner);		// copy the counters of the owner
+		void* owner;
+		const char* (*name)(uint8_t aFunction);		// BDOS function names
+		bool waiting;
+		bool shown;		// waiting, in the file
+		uint64_t instructions;
+		uint64_t cycles;
+		uint64_t consoleIn;
+		uint64_t consoleOut;
+		uint64_t fileRead;
+		uint64_t fileWritten;
+		unsigned files;
+		uint64_t bdos[256];
+	};
+
+/**
+ * Write the metrics.
+ * @param aSpec "FILE[@SECONDS]": metrics file, and its period (5 s by default).
+ * @return false if the period is invalid or the file can't be created.
+ */
+	static bool configure(const std::string& aSpec) {
+		const auto at = aSpec.rfind('@');
+		auto& s = settings();
+		if (at != std::string::npos) {
+			char* end;
+			const auto n = strtoul(aSpec.c_str() + at + 1, &end, 10);
+			if (*end || !n) {
+				std::cerr << ">> Invalid metrics period \"" << aSpec.substr(at + 1) << "\"!" << std::endl;
+				return false;
+			}
+			s.period = std::chrono::seconds(n);
+		}
+		s.path = aSpec.substr(0, at);
+		std::ofstream fs(s.path, std::ios::trunc);
+		if (!fs) {
+			std::cerr << ">> Error creating metrics file \"" << s.path << "\"!" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+/**
+ * @return true if the metrics are written.
+ */
+	static bool enabled() {
+		return !settings().path.empty();
+	}
+
+/**
+ * @return true if the file is to be written again (called by the running
+ *         machines every few thousand instructions).
+ */
+	static bool due() {
+		return enabled() && (std::chrono::steady_clock::now() >= settings().next);
+	}
+
+/**
+ * A machine starts waiting for the console input: the file is written if it
+ * shows the machine running or if due, else at the next period (see flush).
+ */
+	static void idle(const Machine* aMachine) {
+		if (!aMachine->shown || due()) write();
+		else settings().dirty = true;
+	}
+
+/**
+ * Write the file if a change is waiting and due (called by the server while
+ * the machines wait).
+ */
+	static void flush() {
+		if (settings().dirty && due()) write();
+	}
+
+/**
+ * @return the milliseconds before a waiting change is due, -1 without any.
+ */
+	static int timeout() {
+		const auto& s = settings();
+		if (!s.dirty) return -1;
+		const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(s.next - std::chrono::steady_clock::now()).count();
+		return int(std::max<decltype(left)>(left, 0));
+	}
+
+/**
+ * A machine starts: its counters are written with the others.
+ * @param aRefresh Copy the counters of aOwner into aMachine, called before
+ *        each write.
+ */
+	static void attach(Machine* aMachine, void (*aRefresh)(void*), void* aOwner) {
+		auto& s = settings();
+		aMachine->refresh = aRefresh;
+		aMachine->owner = aOwner;
+		aMachine->id = ++s.machines;
+		s.live.push_back(aMachine);
+	}
+
+/**
+ * A machine ends: its last counters are written, and then left out.
+ */
+	static void detach(Machine* aMachine) {
+		auto& s = settings();
+		write();
+		s.live.erase(std::remove(s.live.begin(), s.live.end(), aMachine), s.live.end());
+	}
+
+/**
+ * Rewrite the file (through a temporary file, so that it is never read half
+ * written).
+ */
+	static void write() {
+		auto& s = settings();
+		s.next = std::chrono::steady_clock::now() + s.period;
+		s.dirty = false;
+		for (const auto m : s.live) {
+			m->refresh(m->owner);
+			m->shown = m->waiting;
+		}
+		const auto temporary = s.path + ".tmp";
+		{
+			std::ofstream fs(temporary, std::ios::trunc);
+			report(fs);
+			if (!fs) return;
+		}
+		std::rename(temporary.c_str(), s.path.c_str());
+	}
+
+/**
+ * Write the metrics of the live machines.
+ */
+	static void report(std::ostream& aOut) {
+		const auto& s = settings();
+		const auto counter = [&aOut, &s](const char* aName, const char* aHelp, uint64_t Machine::*aField, const char* aLabel = NULL) {
+			aOut << "# HELP " << aName << ' ' << aHelp << "\n# TYPE " << aName << " counter\n";
+			for (const auto m : s.live) aOut << aName << "{machine=\"" << m->id << '"' << (aLabel ? aLabel : "") << "} " << m->*aField << '\n';
+		};
+		counter("cpm_instructions_total", "Z80 instructions executed.", &Machine::instructions);
+		counter("cpm_cycles_total", "Z80 T-states executed.", &Machine::cycles);
+		aOut << "# HELP cpm_bdos_calls_total BDOS calls by function.\n# TYPE cpm_bdos_calls_total counter\n";
+		for (const auto m : s.live) {
+			for (unsigned f = 0; f < 256; ++f) {
+				if (!m->bdos[f]) continue;
+				const auto name = m->name ? m->name(f) : NULL;
+				aOut << "cpm_bdos_calls_total{machine=\"" << m->id << "\",function=\"";
+				if (name) aOut << name;
+				else aOut << f;
+				aOut << "\"} " << m->bdos[f] << '\n';
+			}
+		}
+		aOut << "# HELP cpm_console_bytes_total Console bytes read & written by the programs.\n# TYPE cpm_console_bytes_total counter\n";
+		for (const auto m : s.live) {
+			aOut << "cpm_console_bytes_total{machine=\"" << m->id << "\",direction=\"in\"} " << m->consoleIn << '\n';
+			aOut << "cpm_console_bytes_total{machine=\"" << m->id << "\",direction=\"out\"} " << m->consoleOut << '\n';
+		}
+		aOut << "# HELP cpm_file_bytes_total File bytes read & written by the BDOS (records).\n# TYPE cpm_file_bytes_total counter\n";
+		for (const auto m : s.live) {
+			aOut << "cpm_file_bytes_total{machine=\"" << m->id << "\",direction=\"read\"} " << m->fileRead << '\n';
+			aOut << "cpm_file_bytes_total{machine=\"" << m->id << "\",direction=\"write\"} " << m->fileWritten << '\n';
+		}
+		aOut << "# HELP cpm_open_files Files opened by the programs.\n# TYPE cpm_open_files gauge\n";
+		for (const auto m : s.live) aOut << "cpm_open_files{machine=\"" << m->id << "\"} " << m->files << '\n';
+		aOut << "# HELP cpm_waiting_input 1 if the machine waits for the console input.\n# TYPE cpm_waiting_input gauge\n";
+		for (const auto m : s.live) aOut << "cpm_waiting_input{machine=\"" << m->id << "\"} " << (m->waiting ? 1 : 0) << '\n';
+		aOut << "# HELP cpm_host_files_open Host files opened by the handles of the process.\n# TYPE cpm_host_files_open gauge\n";
+		aOut << "cpm_host_files_open " << FileHandle::opened() << '\n';
+		aOut << "# HELP cpm_machines Machines running.\n# TYPE cpm_machines gauge\n";
+		aOut << "cpm_machines " << s.live.size() << '\n';
+		aOut << "# HELP cpm_metrics_timestamp_seconds Time of this update.\n# TYPE cpm_metrics_timestamp_seconds gauge\n";
+		aOut << "cpm_metrics_timestamp_seconds " << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count() << std::endl;
+	}
+
+private:
+	struct Settings {
+		std::string path;
+		std::chrono::steady_clock::duration period = std::chrono::seconds(DEFAULT_PERIOD);
+		std::chrono::steady_clock::time_point next;
+		std::vector<Machine*> live;
+		unsigned machines = 0;
+		bool dirty = false;
+	};
+
+	static Settings& settings() {
+		static Settings s;
+		return s;
+	}
+};
@@ -0,0 +1,262 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include "disassembler.h"
+
+/**
+ * Opcode mix of a workload: executions of every opcode (with its CB, ED, DD,
+ * FD, DDCB or FDCB prefix), and of the most common sequences of 2 & 3
+ * consecutive opcodes, the candidates for superinstructions. Written at exit
+ * as CSV, or JSON for a ".json" file.
+ * Only the machines built with the OPCODES flag of Computer count, the others
+ * have no code for it.
+ */
+class OpcodeMix {
+public:
+/**
+ * Opcodes: 256 by prefix (none, CB, ED, DD, FD, DDCB, FDCB).
+ */
+	static constexpr unsigned KEYS = 7 * 256;
+
+/**
+ * Sequences written by length.
+ */
+	static constexpr unsigned SEQUENCES = 100;
+
+/**
+ * Last two opcodes executed by a machine (KEYS: none), so that the sequences
+ * of the machines sharing a thread are not mixed.
+ */
+	struct History {
+		unsigned previous[2] = { KEYS, KEYS };
+	};
+
+/**
+ * Count the opcodes.
+ * @param aPath Report file, truncated & written at exit.
+ * @param aWorkload Name of the workload in the report.
+ * @return false if the file can't be created.
+ */
+	static bool configure(const std::string& aPath, const std::string& aWorkload) {
+		std::ofstream fs(aPath, std::ios::trunc);
+		if (!fs) {
+			std::cerr << ">> Error creating opcodes file \"" << aPath << "\"!" << std::endl;
+			return false;
+		}
+		auto& s = settings();
+		s.path = aPath;
+		s.workload = aWorkload;
+		auto extension = aPath.substr(std::min(aPath.rfind('.'), aPath.size()));
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		s.json = (extension == ".json");
+		if (!s.registered) {
+			s.registered = true;
+			counters();
+			std::atexit(write);
+		}
+		return true;
+	}
+
+/**
+ * @return true if the opcodes are counted.
+ */
+	static bool enabled() {
+		return !settings().path.empty();
+	}
+
+/**
+ * Count the instruction at an address.
+ * @param aMemory Memory of the machine, of aSize bytes.
+ * @param aHistory Last opcodes of the machine, updated.
+ */
+	static void count(const uint16_t aPC, const uint8_t aMemory[], const size_t aSize, History& aHistory) {
+		uint8_t code[Disassembler::MAX_LENGTH];
+		for (unsigned i = 0; i < Disassembler::MAX_LENGTH; ++i) code[i] = aMemory[(aPC + i) % aSize];
+		const unsigned k = key(code);
+		auto& c = counters();
+		auto& previous = aHistory.previous;
+		++c.opcodes[k];
+		if (previous[1] < KEYS) {
+			++c.pairs[previous[1] * KEYS + k];
+			if (previous[0] < KEYS) ++c.triples[(uint64_t(previous[0]) * KEYS + previous[1]) * KEYS + k];
+		}
+		previous[0] = previous[1];
+		previous[1] = k;
+	}
+
+/**
+ * Write the opcodes, the pairs & the triples, by decreasing count.
+ */
+	static void report(std::ostream& aOut) {
+		const auto& c = counters();
+		const auto& s = settings();
+		uint64_t total = 0;
+		std::vector<std::pair<uint64_t, std::vector<unsigned>>> opcodes, pairs, triples;
+		for (unsigned k = 0; k < KEYS; ++k) {
+			total += c.opcodes[k];
+			if (c.opcodes[k]) opcodes.push_back({ c.opcodes[k], { k } });
+		}
+		for (unsigned p = 0; p < KEYS * KEYS; ++p) {
+			if (c.pairs[p]) pairs.push_back({ c.pairs[p], { p / KEYS, p % KEYS } });
+		}
+		for (const auto& t : c.triples) {
+			triples.push_back({ t.second, { unsigned(t.first / KEYS / KEYS), unsigned(t.first / KEYS % KEYS), unsigned(t.first % KEYS) } });
+		}
+		sort(opcodes, KEYS);
+		sort(pairs, SEQUENCES);
+		sort(triples, SEQUENCES);
+
+		if (s.json) {
+			aOut << "{\n  \"workload\": \"" << escape(s.workload) << "\",\n  \"instructions\": " << total;
+			for (const auto& list : { std::make_pair("opcodes", &opcodes), std::make_pair("pairs", &pairs), std::make_pair("triples", &triples) }) {
+				aOut << ",\n  \"" << list.first << "\": [";
+				for (size_t i = 0; i < list.second->size(); ++i) {
+					const auto& e = (*list.second)[i];
+					aOut << (i ? ",\n" : "\n") << "    { \"count\": " << e.first << ", \"bytes\": [";
+					for (size_t j = 0; j < e.second.size(); ++j) aOut << (j ? ", " : "") << '"' << bytes(e.second[j]) << '"';
+					aOut << "], \"instructions\": [";
+					for (size_t j = 0; j < e.second.size(); ++j) aOut << (j ? ", " : "") << '"' << escape(text(e.second[j])) << '"';
+					aOut << "] }";
+				}
+				aOut << "\n  ]";
+			}
+			aOut << "\n}" << std::endl;
+		} else {
+			aOut << "workload,kind,count,share,bytes,instructions" << std::endl;
+			for (const auto& list : { std::make_pair("opcode", &opcodes), std::make_pair("pair", &pairs), std::make_pair("triple", &triples) }) {
+				for (const auto& e : *list.second) {
+					char share[16];
+					snprintf(share, sizeof(share), "%.4f", total ? 100.0 * e.first / total : 0.0);
+					aOut << '"' << escape(s.workload) << "\"," << list.first << ',' << e.first << ',' << share << ",\"";
+					for (size_t j = 0; j < e.second.size(); ++j) aOut << (j ? " / " : "") << bytes(e.second[j]);
+					aOut << "\",\"";
+					for (size_t j = 0; j < e.second.size(); ++j) aOut << (j ? " / " : "") << escape(text(e.second[j]));
+					aOut << '"' << std::endl;
+				}
+			}
+		}
+	}
+
+protected:
+/**
+ * @return the opcode of an instruction, with its prefix: 0-255 none, then
+ *         256 by CB, ED, DD, FD, DDCB & FDCB prefix.
+ */
+	static unsigned key(const uint8_t aCode[]) {
+		switch (aCode[0]) {
+			case 0xCB : return 0x100 | aCode[1];
+			case 0xED : return 0x200 | aCode[1];
+			case 0xDD :
+			case 0xFD : {
+				const unsigned prefix = (aCode[0] == 0xDD) ? 3 : 4;
+				return (aCode[1] == 0xCB) ? ((prefix + 2) << 8) | aCode[3] : (prefix << 8) | aCode[1];
+			}
+			default : return aCode[0];
+		}
+	}
+
+/**
+ * @return the bytes of an opcode, e.g. "DD CB 7E" (displacement left out).
+ */
+	static std::string bytes(const unsigned aKey) {
+		static const char* const PREFIXES[] = { "", "CB ", "ED ", "DD ", "FD ", "DD CB ", "FD CB " };
+		char text[16];
+		snprintf(text, sizeof(text), "%s%02X", PREFIXES[aKey >> 8], aKey & 0xFF);
+		return text;
+	}
+
+/**
+ * @return the instruction of an opcode, its operands zeroed.
+ */
+	static std::string text(const unsigned aKey) {
+		static const uint8_t PREFIXES[][2] = { {}, { 0xCB }, { 0xED }, { 0xDD }, { 0xFD }, { 0xDD, 0xCB }, { 0xFD, 0xCB } };
+		uint8_t code[Disassembler::MAX_LENGTH + 2] = {};
+		const auto prefix = aKey >> 8;
+		const unsigned length = (prefix >= 5) ? 2 : (prefix ? 1 : 0);
+		for (unsigned i = 0; i < length; ++i) code[i] = PREFIXES[prefix][i];
+		code[(prefix >= 5) ? 3 : length] = aKey & 0xFF;
+		char t[Disassembler::TEXT_SIZE];
+		Disassembler::disassemble(code, 0, t, sizeof(t));
+		return t;
+	}
+
+/**
+ * @return a text quoted for the report format.
+ */
+	static std::string escape(const std::string& aText) {
+		const bool json = settings().json;
+		std::string e;
+		for (const auto c : aText) {
+			if ((c == '"') || (json && (c == '\\'))) e += json ? '\\' : '"';		// JSON escape, or CSV quote doubled
+			e += c;
+		}
+		return e;
+	}
+
+/**
+ * Sort by decreasing count, and keep the first ones.
+ */
+	static void sort(std::vector<std::pair<uint64_t, std::vector<unsigned>>>& aList, const size_t aKept) {
+		const auto n = std::min(aList.size(), aKept);
+		std::partial_sort(aList.begin(), aList.begin() + n, aList.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+		aList.resize(n);
+	}
+
+	static void write() {
+		std::ofstream fs(settings().path, std::ios::trunc);
+		report(fs);
+	}
+
+private:
+	struct Settings {
+		std::string path;
+		std::string workload;
+		bool json = false;
+		bool registered = false;
+	};
+
+	static Settings& settings() {
+		static Settings s;
+		return s;
+	}
+
+/**
+ * Executions by opcode, by pair (dense) & by triple (sparse).
+ */
+	struct Counters {
+		uint64_t opcodes[KEYS] = {};
+		std::vector<uint64_t> pairs = std::vector<uint64_t>(KEYS * KEYS);
+		std::unordered_map<uint64_t, uint64_t> triples;
+	};
+
+	static Counters& counters() {
+		static Counters c;
+		return c;
+	}
+};
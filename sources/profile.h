@@ -0,0 +1,259 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <csignal>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include "disassembler.h"
+#include "symbols.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/time.h>
+#define PROFILE_TIMER 1
+#endif
+
+/**
+ * Sampling profiler of the programs: the PC of the running machine is read
+ * every N emulated cycles, or on a host SIGPROF timer (CPU time, BDOS & BIOS
+ * calls included), into a histogram of the 64K addresses. At exit, the hot
+ * spots are written in a report, by symbol (see Symbols) and by instruction,
+ * disassembled.
+ * A sample is an increment, and the cycles counting a compare by instruction,
+ * so the profiler may be left on.
+ */
+class Profile {
+public:
+	static constexpr uint64_t DEFAULT_CYCLES = 10007;		// prime, not in phase with the loops
+	static constexpr unsigned HOT_SPOTS = 50;
+
+/**
+ * What the timer samples: the PC & the memory of the running machine.
+ */
+	struct Target {
+		const uint16_t* pc;
+		const uint8_t* memory;
+		size_t size;
+	};
+
+/**
+ * Profile the machines.
+ * @param aSpec "FILE[@CYCLES|@RATEhz]": report file, and sampling period in
+ *        emulated cycles (10007 by default) or rate of the SIGPROF timer.
+ * @return false if the period is invalid or the file can't be created.
+ */
+	static bool configure(const std::string& aSpec) {
+		const auto at = aSpec.rfind('@');
+		auto& s = settings();
+		s.cycles = DEFAULT_CYCLES;
+		s.rate = 0;
+		if (at != std::string::npos) {
+			char* end;
+			const auto n = strtoull(aSpec.c_str() + at + 1, &end, 10);
+			if (!strcmp(end, "hz") && n && (n <= 10000)) {
+#ifdef PROFILE_TIMER
+				s.rate = n;
+				s.cycles = 0;
+#else
+				std::cerr << ">> Profile timer is not available on this platform!" << std::endl;
+				return false;
+#endif
+			} else if (!*end && n) {
+				s.cycles = n;
+			} else {
+				std::cerr << ">> Invalid profile period \"" << aSpec.substr(at + 1) << "\"!" << std::endl;
+				return false;
+			}
+		}
+		s.path = aSpec.substr(0, at);
+		std::ofstream fs(s.path, std::ios::trunc);
+		if (!fs) {
+			std::cerr << ">> Error creating profile file \"" << s.path << "\"!" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+/**
+ * Start the configured profiler, once; the report is written at exit.
+ */
+	static void start() {
+		auto& s = settings();
+		if (s.path.empty() || s.started) return;
+		s.started = true;
+		histogram();
+		target();
+		std::atexit(stop);
+#ifdef PROFILE_TIMER
+		if (s.rate) {
+			std::signal(SIGPROF, onTimer);
+			const long usec = 1000000L / s.rate;
+			itimerval t = { { usec / 1000000, usec % 1000000 }, { usec / 1000000, usec % 1000000 } };
+			setitimer(ITIMER_PROF, &t, NULL);
+		}
+#endif
+	}
+
+/**
+ * @return the emulated cycles between samples, or 0 (not profiled by cycles).
+ */
+	static uint64_t period() {
+		const auto& s = settings();
+		return s.started ? s.cycles : 0;
+	}
+
+/**
+ * Count a sample.
+ * @param aMemory Memory of the machine, of aSize bytes.
+ */
+	static void sample(const uint16_t aPC, const uint8_t aMemory[], const size_t aSize) {
+		auto& h = histogram();
+		++h.counts[aPC];
+		for (unsigned i = 0; i < Disassembler::MAX_LENGTH; ++i) h.code[aPC + i] = aMemory[(aPC + i) % aSize];
+	}
+
+/**
+ * Set the machine sampled by the timer.
+ * @param aTarget Running machine, or NULL when none runs.
+ */
+	static void running(const Target* aTarget) {
+		target().store(aTarget, std::memory_order_relaxed);
+	}
+
+/**
+ * A machine is deleted: the timer stops sampling it.
+ */
+	static void forget(const Target* aTarget) {
+		auto t = aTarget;
+		target().compare_exchange_strong(t, NULL);
+	}
+
+/**
+ * Write the report: the samples by symbol, then the hottest instructions.
+ */
+	static void report(std::ostream& aOut) {
+		const auto& s = settings();
+		const auto& h = histogram();
+		uint64_t total = 0;
+		for (const auto c : h.counts) total += c;
+		aOut << "Profile: " << total << " samples, ";
+		if (s.rate) aOut << s.rate << " Hz (SIGPROF)" << std::endl;
+		else aOut << "every " << s.cycles << " cycles" << std::endl;
+		if (!total) return;
+
+		char line[128];
+		const auto& symbols = Symbols::all();
+		if (!symbols.empty()) {
+			std::vector<std::pair<uint64_t, const char*>> functions;
+			uint64_t unknown = 0;
+			for (unsigned addr = 0; addr < 0x10000; ++addr) {
+				if (!h.counts[addr]) continue;
+				const auto symbol = Symbols::find(addr);
+				if (!symbol) {
+					unknown += h.counts[addr];
+				} else if (!functions.empty() && (functions.back().second == symbol->name.c_str())) {
+					functions.back().first += h.counts[addr];
+				} else {
+					functions.emplace_back(h.counts[addr], symbol->name.c_str());
+				}
+			}
+			if (unknown) functions.emplace_back(unknown, "(no symbol)");
+			std::stable_sort(functions.begin(), functions.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+			aOut << std::endl << "By symbol:" << std::endl;
+			for (const auto& f : functions) {
+				snprintf(line, sizeof(line), "%6.2f%% %10llu  %s", 100.0 * f.first / total, (unsigned long long)f.first, f.second);
+				aOut << line << std::endl;
+			}
+		}
+
+		std::vector<uint16_t> hot;
+		for (unsigned addr = 0; addr < 0x10000; ++addr) {
+			if (h.counts[addr]) hot.push_back(addr);
+		}
+		const auto n = std::min<size_t>(hot.size(), HOT_SPOTS);
+		std::partial_sort(hot.begin(), hot.begin() + n, hot.end(), [&h](const uint16_t a, const uint16_t b) { return h.counts[a] > h.counts[b]; });
+		aOut << std::endl << "Hot spots:" << std::endl;
+		for (size_t i = 0; i < n; ++i) {
+			const auto addr = hot[i];
+			char text[Disassembler::TEXT_SIZE];
+			char name[64];
+			Disassembler::disassemble(h.code + addr, addr, text, sizeof(text));
+			Symbols::locate(addr, name, sizeof(name));
+			snprintf(line, sizeof(line), "%6.2f%% %10llu  %04X  %-24s %s", 100.0 * h.counts[addr] / total, (unsigned long long)h.counts[addr], addr, name, text);
+			aOut << line << std::endl;
+		}
+	}
+
+protected:
+	static void stop() {
+#ifdef PROFILE_TIMER
+		if (settings().rate) {
+			const itimerval t = {};
+			setitimer(ITIMER_PROF, &t, NULL);
+		}
+#endif
+		running(NULL);
+		std::ofstream fs(settings().path, std::ios::trunc);
+		report(fs);
+	}
+
+#ifdef PROFILE_TIMER
+	static void onTimer(int) {
+		if (const auto t = target().load(std::memory_order_relaxed)) sample(*t->pc, t->memory, t->size);
+	}
+#endif
+
+private:
+	struct Settings {
+		std::string path;
+		uint64_t cycles = DEFAULT_CYCLES;
+		unsigned rate = 0;
+		bool started = false;
+	};
+
+	static Settings& settings() {
+		static Settings s;
+		return s;
+	}
+
+/**
+ * Samples by address, and the code sampled (for the disassembly).
+ */
+	struct Histogram {
+		uint32_t counts[0x10000];
+		uint8_t code[0x10000 + Disassembler::MAX_LENGTH];
+	};
+
+	static Histogram& histogram() {
+		static Histogram h = {};
+		return h;
+	}
+
+	static std::atomic<const Target*>& target() {
+		static std::atomic<const Target*> t(NULL);
+		return t;
+	}
+};
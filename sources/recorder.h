@@ -0,0 +1,200 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <chrono>
+
+/**
+ * Recording of a console session: what was shown on the host terminal and
+ * what was typed, with the timings.
+ * The file starts with "CPMREC" 01h 00h, the columns & rows (16-bit little
+ * endian) and the start time (64-bit Unix time). Then come the chunks: the
+ * delay since the previous one (microseconds), the kind ('o' output, 'i'
+ * input), the length and the bytes; delay & length are varints (7 bits by
+ * byte, low first, bit 7 set when more follow). A chunk is a whole console
+ * write or read, so the cost is a clock read by system call; the chunks are
+ * written by 64 KB blocks, and when the program waits for a key.
+ */
+class Recorder {
+public:
+	static constexpr size_t BUFFER_SIZE = 65536;
+
+	enum Kind : char { OUTPUT = 'o', INPUT = 'i' };
+
+/**
+ * Record the session of the console in a file.
+ * @param aPath File path, truncated.
+ * @return false if the file can't be created.
+ */
+	static bool configure(const std::string& aPath) {
+		std::ofstream fs(aPath, std::ios::binary | std::ios::trunc);
+		if (!fs) {
+			std::cerr << ">> Error creating record file \"" << aPath << "\"!" << std::endl;
+			return false;
+		}
+		settings() = aPath;
+		return true;
+	}
+
+/**
+ * Create the configured recorder, once.
+ * @param aColumns Columns of the terminal.
+ * @param aRows Rows of the terminal.
+ * @return the recorder or NULL.
+ */
+	static Recorder* create(const unsigned aColumns, const unsigned aRows) {
+		auto& path = settings();
+		if (path.empty()) return NULL;
+		const auto r = new Recorder(path, aColumns, aRows);
+		path.clear();
+		return r;
+	}
+
+	Recorder(const std::string& aPath, const unsigned aColumns, const unsigned aRows) :
+		fs(aPath, std::ios::binary | std::ios::trunc),
+		last(std::chrono::steady_clock::now()) {
+		buffer.append("CPMREC\x01\x00", 8);
+		fixed(aColumns, 2);
+		fixed(aRows, 2);
+		fixed(uint64_t(time(NULL)), 8);
+	}
+
+	Recorder(const Recorder&) = delete;
+	Recorder& operator=(const Recorder&) = delete;
+
+	~Recorder() {
+		flush();
+	}
+
+/**
+ * Record a chunk.
+ */
+	void record(const Kind aKind, const char* aData, const size_t aLength) {
+		if (!aLength) return;
+		const auto now = std::chrono::steady_clock::now();
+		const auto delay = std::chrono::duration_cast<std::chrono::microseconds>(now - last);
+		last += delay;
+		varint(delay.count());
+		buffer.push_back(aKind);
+		varint(aLength);
+		buffer.append(aData, aLength);
+		if (buffer.size() >= BUFFER_SIZE) flush();
+	}
+
+	void flush() {
+		if (buffer.empty()) return;
+		fs.write(buffer.data(), buffer.size());
+		fs.flush();
+		buffer.clear();
+	}
+
+/**
+ * Convert a record into an asciicast (v2) file.
+ * @param aPath Record file path.
+ * @param aOut asciicast output.
+ * @return false if the record can't be read.
+ */
+	static bool convert(const std::string& aPath, std::ostream& aOut) {
+		std::ifstream fs(aPath, std::ios::binary);
+		const std::string data((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+		if (!fs.is_open() || (data.size() < 20) || data.compare(0, 8, std::string("CPMREC\x01\x00", 8))) {
+			std::cerr << ">> Invalid record file \"" << aPath << "\"!" << std::endl;
+			return false;
+		}
+		size_t p = 8;
+		const auto columns = unfixed(data, p, 2);
+		const auto rows = unfixed(data, p, 2);
+		const auto start = unfixed(data, p, 8);
+		aOut << "{\"version\": 2, \"width\": " << columns << ", \"height\": " << rows << ", \"timestamp\": " << start << "}\n";
+		uint64_t elapsed = 0;
+		while (p < data.size()) {
+			uint64_t delay, length;
+			if (!unvarint(data, p, delay) || (p >= data.size())) break;
+			const char kind = data[p++];
+			if (!unvarint(data, p, length) || (length > data.size() - p)) break;
+			elapsed += delay;
+			char stamp[32];
+			snprintf(stamp, sizeof(stamp), "%llu.%06llu", (unsigned long long)(elapsed / 1000000), (unsigned long long)(elapsed % 1000000));
+			aOut << '[' << stamp << ", \"" << kind << "\", \"";
+			for (size_t i = 0; i < length; ++i) {
+				const uint8_t c = data[p + i];
+				if ((c == '"') || (c == '\\')) {
+					aOut << '\\' << char(c);
+				} else if ((c < ' ') || (c >= 0x7F)) {
+					char u[8];
+					snprintf(u, sizeof(u), "\\u%04x", c);
+					aOut << u;
+				} else {
+					aOut << char(c);
+				}
+			}
+			aOut << "\"]\n";
+			p += length;
+		}
+		if (p != data.size()) std::cerr << ">> Truncated record file \"" << aPath << "\"!" << std::endl;
+		return true;
+	}
+
+protected:
+	void fixed(uint64_t aValue, const unsigned aBytes) {
+		for (unsigned i = 0; i < aBytes; ++i, aValue >>= 8) buffer.push_back(char(aValue & 0xFF));
+	}
+
+	void varint(uint64_t aValue) {
+		while (aValue >= 0x80) {
+			buffer.push_back(char(0x80 | (aValue & 0x7F)));
+			aValue >>= 7;
+		}
+		buffer.push_back(char(aValue));
+	}
+
+	static uint64_t unfixed(const std::string& aData, size_t& p, const unsigned aBytes) {
+		uint64_t v = 0;
+		for (unsigned i = 0; i < aBytes; ++i) v |= uint64_t(uint8_t(aData[p++])) << (8 * i);
+		return v;
+	}
+
+	static bool unvarint(const std::string& aData, size_t& p, uint64_t& aValue) {
+		aValue = 0;
+		for (unsigned shift = 0; (p < aData.size()) && (shift < 64); shift += 7) {
+			const uint8_t c = aData[p++];
+			aValue |= uint64_t(c & 0x7F) << shift;
+			if (!(c & 0x80)) return true;
+		}
+		return false;
+	}
+
+private:
+/**
+ * Path of the record to create.
+ */
+	static std::string& settings() {
+		static std::string path;
+		return path;
+	}
+
+	std::ofstream fs;
+	std::string buffer;
+	std::chrono::steady_clock::time_point last;
+};
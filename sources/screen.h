@@ -0,0 +1,539 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <ostream>
+#include <algorithm>
+
+/**
+ * Virtual screen, fed by the ANSI output of the console (after the terminal
+ * translation), and rendered on the host terminal by frames holding only the
+ * cells changed since the previous one.
+ *  * Rows are damage-tracked, and only their changed cells are compared;
+ *  * Scrolls are done by the host terminal (scroll region set to the screen);
+ *  * The cursor is moved by the shortest sequence (CR, CR/LF, relative or
+ *    absolute move, or by writing again the few unchanged cells to skip);
+ *  * Frames are rendered at most RATE times per second, but at once when the
+ *    program waits for input.
+ */
+class Screen {
+public:
+	enum : uint8_t { BOLD = 0x01, DIM = 0x02, UNDERLINE = 0x04, REVERSE = 0x08 };
+
+/**
+ * @param aColumns Columns of the screen.
+ * @param aRows Rows of the screen.
+ * @param aRate Maximum frames per second.
+ */
+	Screen(const unsigned aColumns, const unsigned aRows, const unsigned aRate) :
+		columns(aColumns),
+		rows(aRows),
+		period(std::chrono::nanoseconds(1000000000 / aRate)),
+		cells(aColumns * aRows, BLANK),
+		shown(aColumns * aRows, BLANK),
+		dirty(aRows, true) {
+	}
+
+/**
+ * Configure the screen of the consoles.
+ * @param aSpec "COLUMNSxROWS[@RATE]", e.g. "80x24@30".
+ * @return false if the specification is invalid.
+ */
+	static bool configure(const std::string& aSpec) {
+		char* e;
+		const auto c = strtoul(aSpec.c_str(), &e, 10);
+		if ((*e != 'x') || (c < 8) || (c > 255)) return false;
+		const auto r = strtoul(e + 1, &e, 10);
+		if ((r < 2) || (r > 255)) return false;
+		auto f = 30UL;
+		if (*e == '@') {
+			f = strtoul(e + 1, &e, 10);
+			if (!f || (f > 1000)) return false;
+		}
+		if (*e) return false;
+		auto& s = settings();
+		s.columns = c;
+		s.rows = r;
+		s.rate = f;
+		s.enabled = true;
+		return true;
+	}
+
+/**
+ * @return a screen as configured, or NULL if none is.
+ */
+	static Screen* create() {
+		const auto& s = settings();
+		return s.enabled ? new Screen(s.columns, s.rows, s.rate) : NULL;
+	}
+
+/**
+ * Parse the output.
+ * @param aString ANSI characters.
+ * @param aLength Number of characters.
+ */
+	void write(const char* aString, const size_t aLength) {
+		metrics().input += aLength;
+		const auto end = aString + aLength;
+		for (auto p = aString; p < end; ++p) {
+			const uint8_t c = *p;
+			switch (state) {
+				case State::TEXT :
+					if ((c >= ' ') && (c != 0x7F)) {
+						print(c);
+					} else {
+						control(c);
+					}
+					break;
+				case State::ESCAPE :
+					escape(c);
+					break;
+				case State::CSI :
+					if ((c >= '0') && (c <= '9')) {
+						params[count] = std::min(params[count] * 10 + (c - '0'), 9999U);
+					} else if (c == ';') {
+						if (count + 1 < MAX_PARAMS) params[++count] = 0;
+					} else if ((c >= 0x40) && (c <= 0x7E)) {
+						csi(c);
+						state = State::TEXT;
+					}	// else private or intermediate characters: ignored
+					break;
+			}
+		}
+	}
+
+/**
+ * @return true if the screen changed since the last frame.
+ */
+	bool damaged() const {
+		return changed;
+	}
+
+/**
+ * @return true if a frame can be rendered, according to the rate.
+ */
+	bool due() const {
+		return changed && (std::chrono::steady_clock::now() - last >= period);
+	}
+
+/**
+ * Render a frame.
+ * @param aOut Host terminal characters, appended.
+ */
+	void render(std::string& aOut) {
+		const auto start = aOut.size();
+		if (!initialized) {
+			aOut += "\x1B[0m";
+			aOut += "\x1B[1;" + std::to_string(rows) + "r";		// scroll region
+			aOut += "\x1B[H\x1B[2J";
+			hostRow = hostColumn = 0;
+			hostAttribute = 0;
+			scrolled = 0;
+			initialized = true;
+		}
+		if (scrolled) {
+			if (scrolled >= rows) {
+				setAttribute(aOut, 0);
+				aOut += "\x1B[H\x1B[2J";
+				hostRow = hostColumn = 0;
+				std::fill(shown.begin(), shown.end(), BLANK);
+			} else {
+				moveTo(aOut, rows - 1, 0);
+				setAttribute(aOut, 0);
+				aOut.append(scrolled, '\n');
+				std::copy(shown.begin() + scrolled * columns, shown.end(), shown.begin());
+				std::fill(shown.end() - scrolled * columns, shown.end(), BLANK);
+			}
+			scrolled = 0;
+		}
+		for (auto r = 0U; r < rows; ++r) {
+			if (dirty[r]) renderRow(aOut, r);
+			dirty[r] = false;
+		}
+		moveTo(aOut, row, column);
+		if (bell) aOut += '\a';
+		bell = false;
+		changed = false;
+
+		const auto now = std::chrono::steady_clock::now();
+		auto& m = metrics();
+		if (!m.frames++) m.first = now.time_since_epoch().count();
+		m.last = now.time_since_epoch().count();
+		m.bytes += aOut.size() - start;
+		last = now;
+	}
+
+/**
+ * Give the host terminal back: scroll region, attributes & cursor on the
+ * last row.
+ */
+	void close(std::string& aOut) {
+		if (!initialized) return;
+		aOut += "\x1B[0m\x1B[r\x1B[" + std::to_string(rows) + ";1H\r\n";
+		initialized = false;
+	}
+
+/**
+ * Print out the frames counters of all the screens.
+ */
+	static void report(std::ostream& aOut) {
+		const auto& m = metrics();
+		if (!m.frames) return;
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::duration(m.last - m.first)).count();
+		aOut << "Screen: " << m.frames << " frames";
+		if (seconds > 0) aOut << " (" << unsigned(m.frames / seconds) << " fps)";
+		aOut << ", " << m.bytes / m.frames << " bytes per frame, " << m.bytes
+			 << " bytes written for " << m.input << " bytes from the programs" << std::endl;
+	}
+
+protected:
+	struct Cell {
+		char c;
+		uint8_t attribute;
+
+		bool operator==(const Cell& aCell) const {
+			return (c == aCell.c) && (attribute == aCell.attribute);
+		}
+		bool operator!=(const Cell& aCell) const {
+			return !(*this == aCell);
+		}
+	};
+
+	static constexpr Cell BLANK = { ' ', 0 };
+
+	Cell& at(const unsigned aRow, const unsigned aColumn) {
+		return cells[aRow * columns + aColumn];
+	}
+
+/**
+ * Blank cells of a row, from aFrom to aTo excluded.
+ */
+	void blank(const unsigned aRow, const unsigned aFrom, const unsigned aTo) {
+		std::fill(cells.begin() + aRow * columns + aFrom, cells.begin() + aRow * columns + aTo, BLANK);
+		damage(aRow);
+	}
+
+	void damage(const unsigned aRow) {
+		dirty[aRow] = true;
+		changed = true;
+	}
+
+	void print(const char c) {
+		if (wrap) {
+			column = 0;
+			lineFeed();
+			wrap = false;
+		}
+		at(row, column) = { c, attribute };
+		damage(row);
+		if (column + 1 == columns) {
+			wrap = true;
+		} else {
+			++column;
+		}
+	}
+
+	void control(const uint8_t c) {
+		switch (c) {
+			case '\r' : column = 0; break;
+			case '\n' : lineFeed(); break;
+			case 0x08 : if (column) --column; break;
+			case '\t' : column = std::min((column / 8 + 1) * 8, columns - 1); break;
+			case 0x07 : bell = changed = true; break;
+			case 0x1B : state = State::ESCAPE; break;
+		}
+		wrap = false;
+	}
+
+	void escape(const uint8_t c) {
+		state = State::TEXT;
+		switch (c) {
+			case '[' :
+				state = State::CSI;
+				count = 0;
+				params[0] = 0;
+				break;
+			case 'M' :	// reverse line feed
+				if (row) --row;
+				else insertLines(0, 1);
+				break;
+			case '7' :
+				savedRow = row;
+				savedColumn = column;
+				break;
+			case '8' :
+				row = savedRow;
+				column = savedColumn;
+				break;
+		}
+		wrap = false;
+	}
+
+	void csi(const uint8_t aFinal) {
+		const auto n = std::max(params[0], 1U);
+		wrap = false;
+		switch (aFinal) {
+			case 'A' : row -= std::min(n, row); break;
+			case 'B' : row = std::min(row + n, rows - 1); break;
+			case 'C' : column = std::min(column + n, columns - 1); break;
+			case 'D' : column -= std::min(n, column); break;
+			case 'H' :
+			case 'f' :
+				row = std::min(std::max(params[0], 1U), rows) - 1;
+				column = std::min(std::max(count ? params[1] : 0, 1U), columns) - 1;
+				break;
+			case 'J' :
+				if (params[0] == 0) {
+					blank(row, column, columns);
+					for (auto r = row + 1; r < rows; ++r) blank(r, 0, columns);
+				} else if (params[0] == 1) {
+					for (auto r = 0U; r < row; ++r) blank(r, 0, columns);
+					blank(row, 0, column + 1);
+				} else {
+					for (auto r = 0U; r < rows; ++r) blank(r, 0, columns);
+				}
+				break;
+			case 'K' :
+				if (params[0] == 0) blank(row, column, columns);
+				else if (params[0] == 1) blank(row, 0, column + 1);
+				else blank(row, 0, columns);
+				break;
+			case 'L' : insertLines(row, n); break;
+			case 'M' : deleteLines(row, n); break;
+			case '@' : {
+				const auto k = std::min(n, columns - column);
+				const auto line = cells.begin() + row * columns;
+				std::copy_backward(line + column, line + columns - k, line + columns);
+				blank(row, column, column + k);
+				break;
+			}
+			case 'P' : {
+				const auto k = std::min(n, columns - column);
+				const auto line = cells.begin() + row * columns;
+				std::copy(line + column + k, line + columns, line + column);
+				blank(row, columns - k, columns);
+				break;
+			}
+			case 'm' :
+				for (auto i = 0U; i <= count; ++i) {
+					switch (params[i]) {
+						case 0 : attribute = 0; break;
+						case 1 : attribute |= BOLD; break;
+						case 2 : attribute |= DIM; break;
+						case 4 : attribute |= UNDERLINE; break;
+						case 7 : attribute |= REVERSE; break;
+						case 22 : attribute &= ~(BOLD | DIM); break;
+						case 24 : attribute &= ~UNDERLINE; break;
+						case 27 : attribute &= ~REVERSE; break;
+					}
+				}
+				break;
+		}
+	}
+
+	void lineFeed() {
+		if (row + 1 < rows) {
+			++row;
+			return;
+		}
+		std::copy(cells.begin() + columns, cells.end(), cells.begin());
+		std::copy(dirty.begin() + 1, dirty.end(), dirty.begin());
+		blank(rows - 1, 0, columns);
+		++scrolled;		// done by the host terminal on the next frame
+	}
+
+	void insertLines(const unsigned aRow, const unsigned n) {
+		const auto k = std::min(n, rows - aRow);
+		std::copy_backward(cells.begin() + aRow * columns, cells.end() - k * columns, cells.end());
+		for (auto r = aRow; r < rows; ++r) {
+			if (r < aRow + k) blank(r, 0, columns);
+			else damage(r);
+		}
+	}
+
+	void deleteLines(const unsigned aRow, const unsigned n) {
+		const auto k = std::min(n, rows - aRow);
+		std::copy(cells.begin() + (aRow + k) * columns, cells.end(), cells.begin() + aRow * columns);
+		for (auto r = aRow; r < rows; ++r) {
+			if (r >= rows - k) blank(r, 0, columns);
+			else damage(r);
+		}
+	}
+
+/**
+ * Render the changed cells of a row; a blank end of row is cleared at once.
+ */
+	void renderRow(std::string& aOut, const unsigned aRow) {
+		const auto v = cells.data() + aRow * columns;
+		const auto s = shown.data() + aRow * columns;
+		int end = columns;
+		while (end && (v[end - 1] == BLANK)) --end;
+		int shownEnd = columns;
+		while (shownEnd && (s[shownEnd - 1] == BLANK)) --shownEnd;
+		for (auto c = 0; c < end; ++c) {
+			if (v[c] == s[c]) continue;
+			moveTo(aOut, aRow, c);
+			setAttribute(aOut, v[c].attribute);
+			aOut += v[c].c;
+			s[c] = v[c];
+			hostColumn = (c + 1 < int(columns)) ? c + 1 : -1;	// pending wrap: unknown
+		}
+		if (shownEnd > end) {
+			moveTo(aOut, aRow, end);
+			setAttribute(aOut, 0);
+			aOut += "\x1B[K";
+			std::fill(s + end, s + columns, BLANK);
+		}
+	}
+
+/**
+ * Move the host cursor by the shortest sequence.
+ */
+	void moveTo(std::string& aOut, const int aRow, const int aColumn) {
+		if ((hostRow == aRow) && (hostColumn == aColumn)) return;
+		char seq[24];
+		int n;
+		if ((hostRow == aRow) && (hostColumn >= 0) && (aColumn > hostColumn) && (aColumn - hostColumn <= 3) && skip(aRow, aColumn)) {
+			const auto s = shown.data() + aRow * columns;
+			for (auto c = hostColumn; c < aColumn; ++c) aOut += s[c].c;
+		} else if ((aColumn == 0) && (hostRow == aRow)) {
+			aOut += '\r';
+		} else if ((aColumn == 0) && (hostRow >= 0) && (hostRow + 1 == aRow)) {
+			aOut += "\r\n";
+		} else if ((hostRow == aRow) && (hostColumn >= 0)) {
+			n = (aColumn > hostColumn) ? snprintf(seq, sizeof(seq), "\x1B[%dC", aColumn - hostColumn)
+									   : snprintf(seq, sizeof(seq), "\x1B[%dD", hostColumn - aColumn);
+			aOut.append(seq, n);
+		} else {
+			n = snprintf(seq, sizeof(seq), "\x1B[%d;%dH", aRow + 1, aColumn + 1);
+			aOut.append(seq, n);
+		}
+		hostRow = aRow;
+		hostColumn = aColumn;
+	}
+
+/**
+ * @return true if the cells between the host cursor & aColumn can be written
+ * again to move the cursor: same on screen, with the current attribute.
+ */
+	bool skip(const int aRow, const int aColumn) const {
+		const auto v = cells.data() + aRow * columns;
+		const auto s = shown.data() + aRow * columns;
+		for (auto c = hostColumn; c < aColumn; ++c) {
+			if ((v[c] != s[c]) || (s[c].attribute != hostAttribute)) return false;
+		}
+		return true;
+	}
+
+	void setAttribute(std::string& aOut, const uint8_t aAttribute) {
+		if (aAttribute == hostAttribute) return;
+		aOut += "\x1B[0";
+		if (aAttribute & BOLD) aOut += ";1";
+		if (aAttribute & DIM) aOut += ";2";
+		if (aAttribute & UNDERLINE) aOut += ";4";
+		if (aAttribute & REVERSE) aOut += ";7";
+		aOut += 'm';
+		hostAttribute = aAttribute;
+	}
+
+private:
+	static constexpr unsigned MAX_PARAMS = 8;
+
+	enum class State { TEXT, ESCAPE, CSI };
+
+/**
+ * Configuration of the consoles screen.
+ */
+	struct Settings {
+		bool enabled = false;
+		unsigned columns = 80;
+		unsigned rows = 24;
+		unsigned rate = 30;
+	};
+
+	static Settings& settings() {
+		static Settings s;
+		return s;
+	}
+
+/**
+ * Counters, shared by all the screens.
+ */
+	struct Metrics {
+		std::atomic<uint64_t> frames { 0 };
+		std::atomic<uint64_t> bytes { 0 };
+		std::atomic<uint64_t> input { 0 };
+		std::atomic<int64_t> first { 0 };
+		std::atomic<int64_t> last { 0 };
+	};
+
+	static Metrics& metrics() {
+		static Metrics m;
+		return m;
+	}
+
+	const unsigned columns;
+	const unsigned rows;
+	const std::chrono::nanoseconds period;
+
+/**
+ * Virtual screen, & as shown on the host terminal.
+ */
+	std::vector<Cell> cells;
+	std::vector<Cell> shown;
+	std::vector<bool> dirty;
+	bool changed = true;
+
+/**
+ * Virtual cursor & attribute.
+ */
+	unsigned row = 0;
+	unsigned column = 0;
+	bool wrap = false;
+	uint8_t attribute = 0;
+	unsigned savedRow = 0;
+	unsigned savedColumn = 0;
+	bool bell = false;
+
+/**
+ * Rows scrolled since the last frame.
+ */
+	unsigned scrolled = 0;
+
+/**
+ * Parser state.
+ */
+	State state = State::TEXT;
+	unsigned params[MAX_PARAMS] = {};
+	unsigned count = 0;
+
+/**
+ * Host terminal state (-1 when unknown).
+ */
+	bool initialized = false;
+	int hostRow = -1;
+	int hostColumn = -1;
+	uint8_t hostAttribute = 0;
+	std::chrono::steady_clock::time_point last;
+};
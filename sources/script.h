@@ -0,0 +1,191 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "consoleinput.h"
+
+/**
+ * Console input script, for unattended runs. One command by line:
+ *   # comment
+ *   expect TEXT		wait until TEXT is written by the program
+ *   send TEXT		type TEXT
+ *   sendline TEXT	type TEXT then CR
+ * TEXT runs up to the end of the line and may hold \r, \n, \t, \e (ESC), \\
+ * and \xHH escapes. The commands following a match are typed at once, with no
+ * delay: a run only depends on the program & on the script.
+ */
+class Script : public ConsoleInput {
+public:
+/**
+ * Load a script.
+ * @param aPath Script file path.
+ * @return false if the file can't be read or holds an invalid command.
+ */
+	bool load(const std::string& aPath) {
+		std::ifstream fs(aPath);
+		if (!fs) {
+			std::cerr << ">> Error opening script \"" << aPath << "\"!" << std::endl;
+			return false;
+		}
+		steps.clear();
+		std::string line;
+		for (unsigned n = 1; std::getline(fs, line); ++n) {
+			if (!line.empty() && (line.back() == '\r')) line.pop_back();
+			if (line.empty() || (line[0] == '#')) continue;
+			const auto space = line.find(' ');
+			const auto command = line.substr(0, space);
+			const auto text = (space == std::string::npos) ? std::string() : unescape(line.substr(space + 1));
+			if ((command == "expect") && !text.empty()) {
+				steps.push_back({ true, text, n });
+			} else if (command == "send") {
+				steps.push_back({ false, text, n });
+			} else if (command == "sendline") {
+				steps.push_back({ false, text + '\r', n });
+			} else {
+				std::cerr << ">> Invalid script command at line " << n << ": " << line << "!" << std::endl;
+				return false;
+			}
+		}
+		step = 0;
+		seen.clear();
+		typed.clear();
+		run();
+		return true;
+	}
+
+/**
+ * Match the program output against the awaited text.
+ * @param aString Characters written by the program.
+ * @param aLength Number of characters.
+ */
+	void output(const char* aString, const size_t aLength) override {
+		if (done() || !steps[step].expect) return;
+		seen.append(aString, aLength);
+		while (!done() && steps[step].expect) {
+			const auto& text = steps[step].text;
+			const auto found = seen.find(text);
+			if (found == std::string::npos) {
+				if (seen.size() >= text.size()) {
+					seen.erase(0, seen.size() - text.size() + 1);	// keep a possible partial match
+				}
+				return;
+			}
+			seen.erase(0, found + text.size());
+			++step;
+			run();
+		}
+	}
+
+/**
+ * Take the typed characters.
+ * @param aBuffer Destination.
+ * @param aSize Destination size.
+ * @param aWait The program waits for a character.
+ * @return the number of characters taken.
+ * @throw std::runtime_error if the script waits for an output while the
+ *        program waits for an input.
+ */
+	size_t input(char aBuffer[], const size_t aSize, const bool aWait) override {
+		if (typed.empty() && aWait && !done()) {
+			constexpr char SCRIPT_STALLED[] = "Script stalled";
+			std::cerr << ">> " << SCRIPT_STALLED << ": waiting for \"" << steps[step].text
+					  << "\" (line " << steps[step].line << ") while the program waits for input!" << std::endl;
+			throw std::runtime_error(SCRIPT_STALLED);
+		}
+		const auto n = std::min(aSize, typed.size());
+		memcpy(aBuffer, typed.data(), n);
+		typed.erase(0, n);
+		return n;
+	}
+
+/**
+ * @return true when all the commands are run.
+ */
+	bool done() const override {
+		return step >= steps.size();
+	}
+
+protected:
+/**
+ * Type the text of the send commands, up to the next expect.
+ */
+	void run() {
+		while ((step < steps.size()) && !steps[step].expect) {
+			typed += steps[step++].text;
+		}
+	}
+
+/**
+ * Replace the escape sequences.
+ */
+	static std::string unescape(const std::string& aText) {
+		std::string s;
+		for (size_t i = 0; i < aText.size(); ++i) {
+			if ((aText[i] != '\\') || (i + 1 == aText.size())) {
+				s.push_back(aText[i]);
+				continue;
+			}
+			switch (aText[++i]) {
+				case 'r' : s.push_back('\r'); break;
+				case 'n' : s.push_back('\n'); break;
+				case 't' : s.push_back('\t'); break;
+				case 'e' : s.push_back('\x1B'); break;
+				case 'x' : {
+					const auto hex = aText.substr(i + 1, 2);
+					s.push_back(char(strtoul(hex.c_str(), NULL, 16)));
+					i += hex.size();
+					break;
+				}
+				default : s.push_back(aText[i]); break;
+			}
+		}
+		return s;
+	}
+
+private:
+	struct Step {
+		bool expect;
+		std::string text;
+		unsigned line;
+	};
+
+/**
+ * Commands & the current one.
+ */
+	std::vector<Step> steps;
+	size_t step = 0;
+
+/**
+ * Output not matched yet.
+ */
+	std::string seen;
+
+/**
+ * Characters typed, not read yet by the program.
+ */
+	std::string typed;
+};
@@ -0,0 +1,606 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+
+#include "console.h"
+#include "consoleinput.h"
+#include "task.h"
+#include "calls.h"
+#include "metrics.h"
+
+#ifdef __linux__
+#define SERVER_EPOLL 1
+#include <csignal>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#endif
+
+#ifdef SERVER_EPOLL
+
+/**
+ * Console of a session on its connection (non-blocking).
+ * Input is queued by the server from the connection. When the queue is full,
+ * the server stops reading the connection until the program has taken half
+ * of it.
+ * Output is sent at once as far as the connection takes it, the rest is
+ * queued and sent by the server when the connection is writable. While the
+ * queue is full, the server does not resume the session.
+ */
+class Feed : public ConsoleInput {
+public:
+	static constexpr size_t MAX_QUEUED = 65536;
+
+/**
+ * Output queued before the session is held.
+ */
+	static constexpr size_t MAX_UNSENT = 65536;
+
+/**
+ * @param aFd Connection.
+ */
+	explicit Feed(const int aFd) :
+		fd(aFd) {
+	}
+
+	void output(const char*, const size_t aLength) override {
+		written += aLength;
+	}
+
+/**
+ * Send the output, or queue it behind the output not sent yet. The output of
+ * a broken connection is dropped.
+ */
+	bool deliver(const char* aString, const size_t aLength) override {
+		const auto n = unsent.empty() ? send(aString, aLength) : 0;
+		if (n < aLength) {
+			const bool idle = unsent.empty();
+			unsent.append(aString + n, aLength - n);
+			if (idle && onEvents) onEvents();
+		}
+		return true;
+	}
+
+/**
+ * Take the queued characters. The session is suspended while waiting for
+ * them, so it never waits here.
+ * @throw Console::Closed when the connection is closed.
+ */
+	size_t input(char aBuffer[], const size_t aSize, const bool aWait) override {
+		if (closed) throw Console::Closed();
+		if (aWait && queue.empty()) throw std::runtime_error("Session waiting out of the scheduler");
+		const auto n = std::min(aSize, queue.size());
+		std::copy(queue.begin(), queue.begin() + n, aBuffer);
+		queue.erase(queue.begin(), queue.begin() + n);
+		if (paused && (queue.size() <= MAX_QUEUED / 2)) {
+			paused = false;
+			if (onEvents) onEvents();
+		}
+		return n;
+	}
+
+/**
+ * The end of the connection is thrown by input(), stopping the program even
+ * if it only polls the console.
+ */
+	bool done() const override {
+		return false;
+	}
+
+/**
+ * @return the room left in the queue.
+ */
+	size_t room() const {
+		return MAX_QUEUED - queue.size();
+	}
+
+/**
+ * Queue characters read from the connection; reading is paused when the
+ * queue is full.
+ */
+	void push(const char* aString, const size_t aLength) {
+		queue.insert(queue.end(), aString, aString + aLength);
+		read += aLength;
+		if ((queue.size() >= MAX_QUEUED) && !paused) {
+			paused = true;
+			if (onEvents) onEvents();
+		}
+	}
+
+/**
+ * Send the queued output the connection takes.
+ * @return false if the connection is broken.
+ */
+	bool drain() {
+		if (!unsent.empty()) {
+			unsent.erase(0, send(unsent.data(), unsent.size()));
+			if (unsent.empty() && onEvents) onEvents();
+		}
+		return !broken;
+	}
+
+/**
+ * The connection is closed: the program stops at its next console access.
+ */
+	void close() {
+		if (closed) return;
+		closed = true;
+		if (onEvents) onEvents();
+	}
+
+	size_t queued() const {
+		return queue.size();
+	}
+
+/**
+ * @return the output waiting for the connection.
+ */
+	size_t pending() const {
+		return unsent.size();
+	}
+
+/**
+ * @return true if the session must wait for its output to be sent.
+ */
+	bool full() const {
+		return unsent.size() >= MAX_UNSENT;
+	}
+
+/**
+ * @return true if the connection is to be read.
+ */
+	bool reading() const {
+		return !paused && !closed;
+	}
+
+/**
+ * Called when the connection is to be read or written again, or not anymore
+ * (see reading & pending).
+ */
+	std::function<void()> onEvents;
+
+/**
+ * Counters.
+ */
+	uint64_t read = 0;
+	uint64_t written = 0;
+
+protected:
+/**
+ * Write on the connection without waiting.
+ * @return the number of characters sent, or all on a broken connection.
+ */
+	size_t send(const char* aString, const size_t aLength) {
+		size_t sent = 0;
+		while (!broken && (sent < aLength)) {
+			const auto n = ::send(fd, aString + sent, aLength - sent, MSG_NOSIGNAL);
+			if (n >= 0) {
+				sent += n;
+			} else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				return sent;
+			} else if (errno != EINTR) {
+				broken = true;
+				closed = true;
+				unsent.clear();
+			}
+		}
+		return broken ? aLength : sent;
+	}
+
+private:
+	const int fd;
+	std::deque<char> queue;
+	std::string unsent;
+	bool paused = false;
+	bool closed = false;
+	bool broken = false;
+};
+
+/**
+ * Console server on a Unix-domain socket: each connection gets its own
+ * machine, running the CCP (or a program), with its console on the
+ * connection. All the sessions run on the server thread: a run is suspended
+ * while waiting for input, and resumed when the connection brings some; a
+ * running session is suspended every few instructions, sharing the thread
+ * with the others. An idle session costs no CPU.
+ * A session emulates the terminal set by Console::setTerminal, or the one
+ * selected by its client with a first line "TERM=type" (see greet). A session whose client does
+ * not read its output is held until it does (see Feed); the thread never
+ * waits for a connection.
+ * SIGUSR1 prints out the sessions (CPU time, queues), and writes the calls
+ * counters (see Calls); SIGINT or SIGTERM stop the server.
+ */
+template <typename MACHINE>
+class Server {
+public:
+/**
+ * First line of a connection selecting its terminal, and its maximum length.
+ */
+	static constexpr const char* HELLO = "TERM=";
+	static constexpr size_t MAX_HELLO = 32;
+
+/**
+ * @param aPath Socket path.
+ * @param aProgram Program run by the sessions, or empty for the CCP.
+ */
+	Server(const std::string& aPath, const std::string& aProgram) :
+		path(aPath),
+		program(aProgram) {
+	}
+
+	~Server() {
+		for (auto& s : sessions) delete s.second;
+	}
+
+/**
+ * Serve until SIGINT or SIGTERM.
+ * @return false if the server can't be started.
+ */
+	bool run() {
+		sigset_t signals;
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGINT);
+		sigaddset(&signals, SIGTERM);
+		sigaddset(&signals, SIGUSR1);
+		pthread_sigmask(SIG_BLOCK, &signals, NULL);
+		std::signal(SIGPIPE, SIG_IGN);
+
+		listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if ((listener < 0) || (path.size() >= sizeof(addr.sun_path))) return fail("Error creating socket");
+		strcpy(addr.sun_path, path.c_str());
+		struct stat st;
+		if (!lstat(path.c_str(), &st)) {	// a socket left by a previous server, nothing else
+			if (!S_ISSOCK(st.st_mode)) {
+				errno = EEXIST;
+				return fail("Error creating socket");
+			}
+			unlink(path.c_str());
+		}
+		if ((bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) || (listen(listener, 128) < 0)) {
+			return fail("Error binding socket");
+		}
+
+		epoll = epoll_create1(EPOLL_CLOEXEC);
+		const auto sfd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+		if ((epoll < 0) || (sfd < 0)) return fail("Error creating epoll");
+		watch(listener, EPOLLIN);
+		watch(sfd, EPOLLIN);
+
+		MACHINE::banner(std::cout);
+		std::cout << "Listening on " << path << std::endl;
+
+		bool running = true;
+		while (running) {
+			const bool busy = std::any_of(sessions.begin(), sessions.end(), [](const auto& s) { return s.second->ready(); });
+			epoll_event events[64];
+			const auto n = epoll_wait(epoll, events, 64, busy ? 0 : Metrics::timeout());
+			if ((n < 0) && (errno != EINTR)) return fail("Error waiting events");
+			for (auto i = 0; i < n; ++i) {
+				const auto fd = events[i].data.fd;
+				if (fd == listener) {
+					accept();
+				} else if (fd == sfd) {
+					signalfd_siginfo info;
+					while (::read(sfd, &info, sizeof(info)) == sizeof(info)) {
+						if (info.ssi_signo == SIGUSR1) {
+							report(std::cerr);
+							if (Calls::enabled()) Calls::write();
+						}
+						else running = false;
+					}
+				} else {
+					if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) drain(fd);
+					if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) receive(fd);
+				}
+			}
+			schedule();
+			Metrics::flush();
+		}
+
+		close(listener);
+		unlink(path.c_str());
+		for (auto& s : sessions) {
+			s.second->feed.onEvents = nullptr;
+			delete s.second;
+			close(s.first);
+		}
+		sessions.clear();
+		report(std::cerr);
+		close(sfd);
+		close(epoll);
+		return true;
+	}
+
+/**
+ * Print out the sessions: CPU time & queues depth.
+ */
+	void report(std::ostream& aOut) const {
+		aOut << "Server: " << sessions.size() << " sessions (" << total << " since start)" << std::endl;
+		for (const auto& s : sessions) {
+			const auto& session = *s.second;
+			int output = 0;
+			ioctl(s.first, SIOCOUTQ, &output);
+			aOut << "  session #" << session.id << ": cpu " << std::fixed << std::setprecision(3)
+				 << std::chrono::duration<double>(session.cpu).count() << std::defaultfloat
+				 << " s, input queue " << session.feed.queued() << " bytes, output queue " << output << " bytes (+"
+				 << session.feed.pending() << " unsent), " << session.feed.read << " bytes read, " << session.feed.written << " bytes written, "
+				 << (session.over ? "ending" : session.feed.full() ? "waiting for output" : session.runnable ? "running" : "waiting for input") << std::endl;
+		}
+	}
+
+protected:
+	struct Session {
+		Session(const unsigned aId, const int aFd) :
+			id(aId),
+			feed(aFd),
+			computer(-1, aFd, &feed) {
+		}
+
+/**
+ * @return true if the session is to be resumed.
+ */
+		bool ready() const {
+			return runnable && !over && !feed.full();
+		}
+
+		const unsigned id;
+		Feed feed;
+		MACHINE computer;
+
+/**
+ * Current run, and the number of runs started.
+ */
+		Task task;
+		unsigned runs = 0;
+
+/**
+ * Not waiting for input.
+ */
+		bool runnable = true;
+		std::chrono::steady_clock::duration cpu {};
+
+/**
+ * Program over, its last output being sent.
+ */
+		bool over = false;
+
+/**
+ * First line received, and its end reached or not a terminal selection.
+ */
+		std::string hello;
+		bool greeted = false;
+	};
+
+	bool fail(const char* aMessage) {
+		std::cerr << ">> " << aMessage << " \"" << path << "\": " << strerror(errno) << "!" << std::endl;
+		return false;
+	}
+
+	void watch(const int aFd, const uint32_t aEvents) {
+		epoll_event e = {};
+		e.events = aEvents;
+		e.data.fd = aFd;
+		epoll_ctl(epoll, EPOLL_CTL_ADD, aFd, &e);
+	}
+
+/**
+ * Start a session for each waiting connection.
+ */
+	void accept() {
+		while (true) {
+			const auto fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) return;
+			auto s = new Session(++total, fd);
+			s->feed.onEvents = [this, fd, s]() {
+				update(fd, *s);
+			};
+			sessions[fd] = s;
+			watch(fd, EPOLLIN);
+		}
+	}
+
+/**
+ * Watch a connection for the events its session waits for.
+ */
+	void update(const int aFd, const Session& aSession) {
+		epoll_event e = {};
+		e.events = (aSession.feed.reading() ? uint32_t(EPOLLIN) : 0) | (aSession.feed.pending() ? uint32_t(EPOLLOUT) : 0);
+		e.data.fd = aFd;
+		epoll_ctl(epoll, EPOLL_CTL_MOD, aFd, &e);
+	}
+
+/**
+ * Send the output queued for a connection; end its session if the connection
+ * is broken, or once sent if the program is over.
+ */
+	void drain(const int aFd) {
+		const auto it = sessions.find(aFd);
+		if (it == sessions.end()) return;
+		auto& session = *it->second;
+		if (!session.feed.drain() || (session.over && !session.feed.pending())) end(it);
+	}
+
+/**
+ * Queue the characters received on a connection, and wake up its session.
+ */
+	void receive(const int aFd) {
+		const auto it = sessions.find(aFd);
+		if (it == sessions.end()) return;
+		auto& session = *it->second;
+		char buf[4096];
+		const auto room = session.feed.room();
+		if (!room) return;		// paused
+		const auto n = ::read(aFd, buf, std::min(sizeof(buf), room));
+		if (n <= 0) {
+			if ((n < 0) && ((errno == EINTR) || (errno == EAGAIN))) return;
+			session.feed.close();		// the output may still be sent
+		} else if (!session.greeted) {
+			greet(session, buf, n);
+		} else {
+			session.feed.push(buf, n);
+		}
+		session.runnable = true;
+	}
+
+/**
+ * Take the first line of a connection if it selects the terminal emulated by
+ * the session ("TERM=" & a Terminal::parse name, ended by CR or LF); any
+ * other input is typed as is.
+ */
+	void greet(Session& aSession, const char* aData, const size_t aLength) {
+		auto& hello = aSession.hello;
+		hello.append(aData, aLength);
+		const std::string prefix(HELLO);
+		const auto n = std::min(hello.size(), prefix.size());
+		auto end = hello.find_first_of("\r\n");
+		if (!hello.compare(0, n, prefix, 0, n)) {
+			if ((end == std::string::npos) && (hello.size() < MAX_HELLO)) return;	// wait for the line end
+			if (end != std::string::npos) {
+				const auto name = hello.substr(prefix.size(), end - prefix.size());
+				Terminal::Type type;
+				if (Terminal::parse(name, type)) aSession.computer.emulate(type);
+				else std::cerr << ">> Session #" << aSession.id << ": invalid terminal \"" << name << "\"!" << std::endl;
+				if ((hello[end] == '\r') && (end + 1 < hello.size()) && (hello[end + 1] == '\n')) ++end;
+				hello.erase(0, end + 1);
+			}
+		}
+		aSession.greeted = true;
+		if (!hello.empty()) aSession.feed.push(hello.data(), hello.size());
+		hello.clear();
+		hello.shrink_to_fit();
+	}
+
+/**
+ * Resume each running session once, and end the finished ones, once their
+ * output is sent.
+ */
+	void schedule() {
+		for (auto it = sessions.begin(); it != sessions.end(); ) {
+			auto& session = *it->second;
+			if (!session.ready() || resume(session)) {
+				++it;
+				continue;
+			}
+			session.computer.flush();
+			if (session.feed.drain() && session.feed.pending()) {		// wait for the rest to be sent
+				session.over = true;
+				session.feed.close();
+				++it;
+			} else {
+				it = end(it);
+			}
+		}
+	}
+
+/**
+ * End a session.
+ * @return the next session.
+ */
+	typename std::map<int, Session*>::iterator end(const typename std::map<int, Session*>::iterator aIt) {
+		epoll_ctl(epoll, EPOLL_CTL_DEL, aIt->first, NULL);
+		aIt->second->feed.onEvents = nullptr;
+		delete aIt->second;		// last output sent if the connection takes it
+		close(aIt->first);
+		return sessions.erase(aIt);
+	}
+
+/**
+ * Run a session up to its next suspension, starting the CCP again after each
+ * warm boot (or the program once).
+ * @return false when the session is over.
+ */
+	bool resume(Session& aSession) {
+		const auto start = std::chrono::steady_clock::now();
+		bool alive = true;
+		try {
+			auto& computer = aSession.computer;
+			while (!aSession.task.resume()) {
+				if (!program.empty() && aSession.runs) {
+					alive = false;
+					break;
+				}
+				++aSession.runs;
+				if (program.empty()) {
+					computer.init("CCP-DR.64K", 0xF400);
+					aSession.task = computer.start(0xF400);
+				} else {
+					computer.init(program, 0x0100);
+					aSession.task = computer.start(0x0100);
+				}
+			}
+			aSession.runnable = (computer.waits() != MACHINE::Wait::INPUT);
+		} catch (Console::Closed&) {
+			alive = false;		// Connection closed
+		} catch (std::exception& e) {
+			std::cerr << ">> Session #" << aSession.id << ": " << e.what() << "!" << std::endl;
+			alive = false;
+		}
+		aSession.cpu += std::chrono::steady_clock::now() - start;
+		return alive;
+	}
+
+private:
+	const std::string path;
+	const std::string program;
+
+	int listener = -1;
+	int epoll = -1;
+
+/**
+ * Sessions by connection descriptor.
+ */
+	std::map<int, Session*> sessions;
+	unsigned total = 0;
+};
+
+#else
+
+/**
+ * Console server, only available on Linux (epoll).
+ */
+template <typename MACHINE>
+class Server {
+public:
+	Server(const std::string&, const std::string&) {}
+
+	bool run() {
+		std::cerr << ">> Server mode is not available on this platform!" << std::endl;
+		return false;
+	}
+};
+
+#endif
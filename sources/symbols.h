@@ -0,0 +1,164 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/**
+ * Symbols of the programs (labels & their addresses), shown by the traces,
+ * the logs & the profiles as "name+offset".
+ * Files are read at startup:
+ * - symbol files (M80/L80 .SYM, or a simple format): address & name pairs, in
+ *   hexadecimal, several by line, e.g. "0100 START  0123 LOOP";
+ * - assembler listings (.PRN, .LST from M80, ZMAC...): the lines with an
+ *   address and a label ("0103  3E 05   LOOP:  LD A,5").
+ * The symbols are kept sorted by address, and looked up by binary search.
+ */
+class Symbols {
+public:
+	struct Symbol {
+		uint16_t addr;
+		std::string name;
+
+		bool operator<(const Symbol& aSymbol) const {
+			return addr < aSymbol.addr;
+		}
+	};
+
+/**
+ * Load a symbol file or a listing (by its extension, .PRN or .LST).
+ * @param aPath File path.
+ * @return false if it can't be read.
+ */
+	static bool load(const std::string& aPath) {
+		std::ifstream fs(aPath);
+		if (!fs) {
+			std::cerr << ">> Error opening symbols file \"" << aPath << "\"!" << std::endl;
+			return false;
+		}
+		auto extension = aPath.substr(std::min(aPath.rfind('.'), aPath.size()));
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::toupper);
+		const bool listing = (extension == ".PRN") || (extension == ".LST");
+		auto& s = symbols();
+		const auto count = s.size();
+		std::string line;
+		while (std::getline(fs, line)) {
+			if (listing) parseListing(line, s);
+			else parsePairs(line, s);
+		}
+		if (s.size() == count) std::cerr << ">> No symbols in \"" << aPath << "\"!" << std::endl;
+		std::stable_sort(s.begin(), s.end());
+		return true;
+	}
+
+/**
+ * @return all the symbols, sorted by address.
+ */
+	static const std::vector<Symbol>& all() {
+		return symbols();
+	}
+
+/**
+ * @return the name of a symbol at this address, or NULL.
+ */
+	static const char* at(const uint16_t aAddr) {
+		const auto& s = symbols();
+		const auto it = std::lower_bound(s.begin(), s.end(), Symbol { aAddr, std::string() });
+		return ((it != s.end()) && (it->addr == aAddr)) ? it->name.c_str() : NULL;
+	}
+
+/**
+ * @return the closest symbol at or before this address, or NULL.
+ */
+	static const Symbol* find(const uint16_t aAddr) {
+		const auto& s = symbols();
+		const auto it = std::upper_bound(s.begin(), s.end(), Symbol { aAddr, std::string() });
+		return (it == s.begin()) ? NULL : &*(it - 1);
+	}
+
+/**
+ * Write an address as "name+offset" (offset in hexadecimal, e.g. "LOOP+1Ah"),
+ * or "name" on the symbol.
+ * @param aText Buffer of the text, ended by a null character.
+ * @param aSize Buffer size, the text is truncated to it.
+ * @return false if no symbol is before the address (the text is empty).
+ */
+	static bool locate(const uint16_t aAddr, char aText[], const size_t aSize) {
+		if (!aSize) return false;
+		const auto symbol = find(aAddr);
+		if (!symbol) {
+			aText[0] = '\0';
+			return false;
+		}
+		char offset[8] = "";
+		if (aAddr != symbol->addr) snprintf(offset, sizeof(offset), "+%Xh", unsigned(aAddr - symbol->addr));
+		snprintf(aText, aSize, "%s%s", symbol->name.c_str(), offset);
+		return true;
+	}
+
+protected:
+/**
+ * @return the address of a hexadecimal token ("0100", "0100H", "0100'"), or -1.
+ */
+	static long address(std::string aToken) {
+		while (!aToken.empty() && ((aToken.back() == '\'') || (aToken.back() == '"') || (toupper(aToken.back()) == 'H'))) aToken.pop_back();
+		if (aToken.empty() || (aToken.size() > 4)) return -1;
+		char* end;
+		const auto v = strtol(aToken.c_str(), &end, 16);
+		return *end ? -1 : v;
+	}
+
+	static void parsePairs(const std::string& aLine, std::vector<Symbol>& aSymbols) {
+		if (aLine.empty() || (aLine[0] == ';') || (aLine[0] == '#')) return;
+		std::istringstream is(aLine);
+		std::string a, name;
+		while (is >> a >> name) {
+			const auto v = address(a);
+			if (v < 0) return;
+			aSymbols.push_back(Symbol { uint16_t(v), name });
+		}
+	}
+
+	static void parseListing(const std::string& aLine, std::vector<Symbol>& aSymbols) {
+		std::istringstream is(aLine.substr(0, aLine.find(';')));
+		std::string token;
+		long addr = -1;
+		while (is >> token) {
+			if ((token.size() > 1) && (token.back() == ':')) {
+				while (!token.empty() && (token.back() == ':')) token.pop_back();		// "LABEL::" is public in M80
+				if ((addr >= 0) && !token.empty()) aSymbols.push_back(Symbol { uint16_t(addr), token });
+				return;
+			}
+			if ((addr < 0) && (token.size() >= 4)) addr = address(token);
+		}
+	}
+
+private:
+	static std::vector<Symbol>& symbols() {
+		static std::vector<Symbol> s;
+		return s;
+	}
+};
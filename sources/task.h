@@ -0,0 +1,89 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#if __cplusplus < 202002L
+#error "Need C++20 compiler for using <coroutine>"
+#endif
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+/**
+ * Resumable run (C++20 coroutine): it runs until it has to wait, then gives
+ * the control back to the caller, which resumes it later. An exception ending
+ * the run is thrown by resume().
+ */
+class Task {
+public:
+	struct promise_type {
+		Task get_return_object() {
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() {}
+
+		void unhandled_exception() {
+			exception = std::current_exception();
+		}
+
+		std::exception_ptr exception;
+	};
+
+	Task() = default;
+
+	Task(Task&& aTask) noexcept :
+		handle(std::exchange(aTask.handle, nullptr)) {
+	}
+
+	Task& operator=(Task&& aTask) noexcept {
+		if (this != &aTask) {
+			if (handle) handle.destroy();
+			handle = std::exchange(aTask.handle, nullptr);
+		}
+		return *this;
+	}
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	~Task() {
+		if (handle) handle.destroy();
+	}
+
+/**
+ * Run up to the next suspension.
+ * @return false when the run is over (or if there is none).
+ * @throw the exception ending the run.
+ */
+	bool resume() {
+		if (!handle || handle.done()) return false;
+		handle.resume();
+		if (!handle.done()) return true;
+		if (const auto e = std::exchange(handle.promise().exception, nullptr)) std::rethrow_exception(e);
+		return false;
+	}
+
+private:
+	explicit Task(const std::coroutine_handle<promise_type> aHandle) :
+		handle(aHandle) {
+	}
+
+	std::coroutine_handle<promise_type> handle;
+};
@@ -0,0 +1,211 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/**
+ * Translation of the escape sequences of an emulated terminal (ADM-3A or
+ * VT52) into ANSI ones, for the host terminal.
+ * Each terminal is described by a table: replacement of the control
+ * characters, of the ESC sequences, and the ESC sequence addressing the cursor
+ * (row + 32, column + 32). The runs of plain characters between two sequences
+ * are copied in bulk; a sequence may be split between two calls.
+ */
+class Terminal {
+public:
+	enum class Type { NONE, ADM3A, VT52 };
+
+	explicit Terminal(const Type aType = Type::NONE) {
+		select(aType);
+	}
+
+/**
+ * Select the emulated terminal, the current sequence is dropped.
+ */
+	void select(const Type aType) {
+		type = aType;
+		table = (aType == Type::ADM3A) ? &adm3a() : (aType == Type::VT52) ? &vt52() : NULL;
+		state = State::TEXT;
+	}
+
+/**
+ * @return the emulated terminal.
+ */
+	Type selected() const {
+		return type;
+	}
+
+/**
+ * Parse a terminal name.
+ * @param aName "none", "adm3a" or "vt52".
+ * @param aType Terminal type.
+ * @return false if the name is unknown.
+ */
+	static bool parse(const std::string& aName, Type& aType) {
+		if (aName == "none") aType = Type::NONE;
+		else if (aName == "adm3a") aType = Type::ADM3A;
+		else if (aName == "vt52") aType = Type::VT52;
+		else return false;
+		return true;
+	}
+
+/**
+ * Translate the output of the program.
+ * @param aIn Characters written by the program.
+ * @param aLength Number of characters.
+ * @param aOut Host terminal characters, appended.
+ */
+	void translate(const char* aIn, const size_t aLength, std::string& aOut) {
+		if (!table) {
+			aOut.append(aIn, aLength);
+			return;
+		}
+		const auto end = aIn + aLength;
+		auto p = aIn;
+		while (p < end) {
+			if (state == State::TEXT) {
+				auto q = p;
+				while ((q < end) && !table->special[uint8_t(*q)]) ++q;
+				aOut.append(p, q - p);
+				if (q == end) break;
+				p = q;
+			}
+			const uint8_t c = *p++;
+			switch (state) {
+				case State::TEXT :
+					if (c == ESC) {
+						state = State::ESCAPE;
+					} else {
+						aOut += table->control[c];
+					}
+					break;
+				case State::ESCAPE :
+					if (c == table->address) {
+						state = State::ROW;
+					} else {
+						if (c < 128 && table->escape[c]) aOut += table->escape[c];		// unknown: dropped
+						state = State::TEXT;
+					}
+					break;
+				case State::ROW :
+					row = c;
+					state = State::COLUMN;
+					break;
+				case State::COLUMN : {
+					char s[24];
+					const auto n = snprintf(s, sizeof(s), "\x1B[%u;%uH", unsigned(uint8_t(row - 31)), unsigned(uint8_t(c - 31)));
+					aOut.append(s, n);
+					state = State::TEXT;
+					break;
+				}
+			}
+		}
+	}
+
+private:
+	static constexpr uint8_t ESC = 0x1B;
+
+	enum class State { TEXT, ESCAPE, ROW, COLUMN };
+
+/**
+ * Terminal description.
+ */
+	struct Table {
+		bool special[256];			// ESC & the translated control characters
+		const char* control[32];	// replacement of the control characters
+		const char* escape[128];	// replacement of ESC x
+		uint8_t address;			// ESC x addressing the cursor
+
+		Table(const uint8_t aAddress) :
+			special(),
+			control(),
+			escape(),
+			address(aAddress) {
+			special[ESC] = true;
+		}
+
+		void setControl(const uint8_t c, const char* s) {
+			control[c] = s;
+			special[c] = true;
+		}
+	};
+
+/**
+ * Lear Siegler ADM-3A, with the usual ADM-31 & Kaypro extensions.
+ */
+	static const Table& adm3a() {
+		static const Table t = [] {
+			Table a('=');
+			a.setControl(0x0B, "\x1B[A");			// ^K up
+			a.setControl(0x0C, "\x1B[C");			// ^L right
+			a.setControl(0x1A, "\x1B[H\x1B[2J");	// ^Z clear screen
+			a.setControl(0x1E, "\x1B[H");			// ^^ home
+			a.escape['*'] = "\x1B[H\x1B[2J";		// clear screen
+			a.escape[':'] = "\x1B[H\x1B[2J";
+			a.escape['T'] = "\x1B[K";				// clear to end of line
+			a.escape['t'] = "\x1B[K";
+			a.escape['Y'] = "\x1B[J";				// clear to end of screen
+			a.escape['y'] = "\x1B[J";
+			a.escape['E'] = "\x1B[L";				// insert line
+			a.escape['R'] = "\x1B[M";				// delete line
+			a.escape['Q'] = "\x1B[@";				// insert character
+			a.escape['W'] = "\x1B[P";				// delete character
+			a.escape[')'] = "\x1B[2m";				// half intensity
+			a.escape['('] = "\x1B[22m";				// full intensity
+			return a;
+		}();
+		return t;
+	}
+
+/**
+ * DEC VT52, with the usual Heath H19 extensions.
+ */
+	static const Table& vt52() {
+		static const Table t = [] {
+			Table a('Y');
+			a.escape['A'] = "\x1B[A";				// up
+			a.escape['B'] = "\x1B[B";				// down
+			a.escape['C'] = "\x1B[C";				// right
+			a.escape['D'] = "\x1B[D";				// left
+			a.escape['H'] = "\x1B[H";				// home
+			a.escape['I'] = "\x1BM";				// reverse line feed
+			a.escape['J'] = "\x1B[J";				// clear to end of screen
+			a.escape['K'] = "\x1B[K";				// clear to end of line
+			a.escape['E'] = "\x1B[H\x1B[2J";		// clear screen
+			a.escape['L'] = "\x1B[L";				// insert line
+			a.escape['M'] = "\x1B[M";				// delete line
+			a.escape['N'] = "\x1B[P";				// delete character
+			a.escape['b'] = "\x1B[1J";				// clear to start of screen
+			a.escape['l'] = "\x1B[2K";				// clear line
+			a.escape['o'] = "\x1B[1K";				// clear to start of line
+			a.escape['j'] = "\x1B" "7";				// save cursor
+			a.escape['k'] = "\x1B" "8";				// restore cursor
+			a.escape['p'] = "\x1B[7m";				// reverse
+			a.escape['q'] = "\x1B[27m";
+			return a;
+		}();
+		return t;
+	}
+
+	Type type = Type::NONE;
+	const Table* table = NULL;
+	State state = State::TEXT;
+	uint8_t row = 0;
+};
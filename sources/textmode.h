@@ -0,0 +1,164 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <set>
+#include <istream>
+
+/**
+ * Text files translation between the host (LF line ends, no end marker) and
+ * CP/M (CR/LF line ends, ^Z after the last character, padded to 128 bytes).
+ * Files are selected by drive (all files of a drive) or by file type.
+ * Conversions scan the buffers with memchr (vectorized by the C library) and
+ * copy the runs between two line ends in bulk.
+ */
+class TextMode {
+public:
+/**
+ * CP/M end of text file.
+ */
+	static constexpr uint8_t CTRL_Z = 0x1A;
+
+/**
+ * Select the text files.
+ * @param aList Comma separated list of drives ("B:") and file types ("TXT").
+ * @return false if the list is invalid.
+ */
+	static bool configure(const std::string& aList) {
+		auto& p = policy();
+		size_t start = 0;
+		while (start <= aList.size()) {
+			auto end = aList.find(',', start);
+			if (end == std::string::npos) end = aList.size();
+			std::string item = aList.substr(start, end - start);
+			for (auto& c : item) c = toupper(c);
+
+			if ((item.size() == 2) && (item[1] == ':') && (item[0] >= 'A') && (item[0] <= 'P')) {
+				p.drives |= 1U << (item[0] - 'A');
+			} else if (!item.empty() && (item.size() <= 3) && (item.find_first_of(".:*?") == std::string::npos)) {
+				item.resize(3, ' ');
+				p.types.insert(item);
+			} else {
+				return false;
+			}
+			start = end + 1;
+		}
+		return true;
+	}
+
+/**
+ * @param aDrive Drive number (0 for A:).
+ * @param aType File type, 3 chars space padded (attribute bits are ignored).
+ * @return true if the file is to be translated.
+ */
+	static bool isText(const unsigned aDrive, const char aType[3]) {
+		const auto& p = policy();
+		if (p.drives & (1U << aDrive)) return true;
+		if (p.types.empty()) return false;
+		const char type[] = { char(toupper(aType[0] & 0x7F)), char(toupper(aType[1] & 0x7F)), char(toupper(aType[2] & 0x7F)), '\0' };
+		return p.types.count(type);
+	}
+
+/**
+ * Convert a host text into a CP/M image: LF becomes CR/LF (existing CR/LF are
+ * kept), then the last record is padded with ^Z.
+ * @param aIn Host text.
+ * @param aLength Length of the host text.
+ * @param aOut CP/M image, a multiple of 128 bytes.
+ */
+	static void toCPM(const uint8_t* aIn, const size_t aLength, std::vector<uint8_t>& aOut) {
+		aOut.clear();
+		aOut.reserve(aLength + aLength / 16 + 128);
+		const auto end = aIn + aLength;
+		auto p = aIn;
+		while (p < end) {
+			const auto lf = static_cast<const uint8_t*>(memchr(p, '\n', end - p));
+			const auto next = lf ? lf : end;
+			aOut.insert(aOut.end(), p, next);
+			if (!lf) break;
+			if ((lf == aIn) || (lf[-1] != '\r')) aOut.push_back('\r');
+			aOut.push_back('\n');
+			p = lf + 1;
+		}
+		if (aOut.size() % 128) aOut.resize((aOut.size() / 128 + 1) * 128, CTRL_Z);
+	}
+
+/**
+ * Size of the CP/M image of a host text (see toCPM), without converting it.
+ * @param aIn Host text, read up to its end.
+ * @return size of the CP/M image, a multiple of 128 bytes.
+ */
+	static uint64_t cpmSize(std::istream& aIn) {
+		char buffer[16384];
+		uint64_t size = 0;
+		char last = '\0';
+		while (aIn.read(buffer, sizeof(buffer)) || aIn.gcount()) {
+			const auto n = size_t(aIn.gcount());
+			const auto end = buffer + n;
+			size += n;
+			for (auto p = buffer; (p = static_cast<char*>(memchr(p, '\n', end - p))); ++p) {
+				if ((p == buffer) ? (last != '\r') : (p[-1] != '\r')) ++size;
+			}
+			last = end[-1];
+		}
+		return (size + 127) / 128 * 128;
+	}
+
+/**
+ * Convert a CP/M image into a host text: the text ends at the first ^Z, and
+ * CR/LF becomes LF (a lone CR is kept).
+ * @param aIn CP/M image.
+ * @param aLength Length of the CP/M image.
+ * @param aOut Host text.
+ */
+	static void toHost(const uint8_t* aIn, const size_t aLength, std::vector<uint8_t>& aOut) {
+		const auto eof = static_cast<const uint8_t*>(memchr(aIn, CTRL_Z, aLength));
+		const auto end = eof ? eof : aIn + aLength;
+		aOut.clear();
+		aOut.reserve(end - aIn);
+		auto p = aIn;
+		while (p < end) {
+			const auto cr = static_cast<const uint8_t*>(memchr(p, '\r', end - p));
+			if (!cr) {
+				aOut.insert(aOut.end(), p, end);
+				break;
+			}
+			aOut.insert(aOut.end(), p, cr);
+			if ((cr + 1 == end) || (cr[1] != '\n')) aOut.push_back('\r');
+			p = cr + 1;
+		}
+	}
+
+private:
+/**
+ * Selected drives (bitmap) & file types.
+ */
+	struct Policy {
+		uint16_t drives = 0;
+		std::set<std::string> types;
+	};
+
+	static Policy& policy() {
+		static Policy p;
+		return p;
+	}
+};
@@ -0,0 +1,270 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define TRACE_POSIX 1
+#else
+#include <io.h>
+#endif
+
+/**
+ * Instruction trace: the last instructions executed by the machine, kept in a
+ * ring buffer of fixed-size binary entries (PC, opcode bytes, registers,
+ * cycles). Recording an entry is a few stores, with no lock: the ring is only
+ * written by the machine, and read when dumped.
+ * The ring is dumped into the trace file on demand (SIGUSR2, taken at the next
+ * poll of the machine), when the machine stops on an error, and on a crash
+ * (from the signal handler). The file starts with "CPMTRC" 01h 00h & the
+ * number of entries (32-bit little endian), then the entries, oldest first;
+ * it is decoded offline into the text log (see Computer::decode).
+ */
+class Trace {
+public:
+	struct Entry {
+		uint16_t pc;
+		uint8_t code[4];		// opcode bytes at PC
+		uint16_t af;
+		uint16_t bc;
+		uint16_t de;
+		uint16_t hl;
+		uint16_t ix;
+		uint16_t iy;
+		uint16_t sp;
+		uint8_t unused[4];
+		uint64_t cycles;		// since power on
+	};
+	static_assert(sizeof(Entry) == 32, "Trace entries are 32 bytes");
+
+	static constexpr size_t DEFAULT_ENTRIES = 65536;
+
+/**
+ * Trace the machine.
+ * @param aSpec "FILE[@ENTRIES]": dump file, truncated, and ring size (rounded
+ *        up to a power of 2).
+ * @return false if the size is invalid or the file can't be created.
+ */
+	static bool configure(const std::string& aSpec) {
+		const auto at = aSpec.rfind('@');
+		auto& s = settings();
+		s.entries = DEFAULT_ENTRIES;
+		if (at != std::string::npos) {
+			char* end;
+			const auto n = strtoul(aSpec.c_str() + at + 1, &end, 10);
+			if (*end || !n || (n > (1UL << 24))) {
+				std::cerr << ">> Invalid trace size \"" << aSpec.substr(at + 1) << "\"!" << std::endl;
+				return false;
+			}
+			for (s.entries = 1; s.entries < n; s.entries <<= 1) {}
+		}
+		const auto path = aSpec.substr(0, at);
+#ifdef TRACE_POSIX
+		s.fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#else
+		s.fd = ::_open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#endif
+		if (s.fd < 0) {
+			std::cerr << ">> Error creating trace file \"" << path << "\"!" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+/**
+ * Create the configured trace, once.
+ * @return the trace or NULL.
+ */
+	static Trace* create() {
+		auto& s = settings();
+		if (s.fd < 0) return NULL;
+		const auto t = new Trace(s.fd, s.entries);
+		s.fd = -1;
+		active() = t;
+#ifdef TRACE_POSIX
+		std::signal(SIGUSR2, onRequest);
+		for (const auto sig : { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT }) {
+#else
+		for (const auto sig : { SIGSEGV, SIGFPE, SIGILL, SIGABRT }) {
+#endif
+			previous(sig) = std::signal(sig, onCrash);
+		}
+		return t;
+	}
+
+	Trace(const Trace&) = delete;
+	Trace& operator=(const Trace&) = delete;
+
+	~Trace() {
+		if (active() == this) active() = NULL;
+#ifdef TRACE_POSIX
+		::close(fd);
+#else
+		::_close(fd);
+#endif
+		delete[] ring;
+	}
+
+/**
+ * @return the entry to record next, kept by commit().
+ */
+	Entry& slot() {
+		return ring[count.load(std::memory_order_relaxed) & mask];
+	}
+
+	void commit() {
+		count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+/**
+ * @return true once after SIGUSR2.
+ */
+	static bool requested() {
+		return request().exchange(false);
+	}
+
+/**
+ * Write the ring into the trace file (async-signal-safe).
+ */
+	void dump() const {
+		const uint64_t n = count.load(std::memory_order_acquire);
+		const uint32_t kept = uint32_t((n > mask + 1) ? mask + 1 : n);
+		uint8_t header[12] = { 'C', 'P', 'M', 'T', 'R', 'C', 0x01, 0x00 };
+		for (unsigned i = 0; i < 4; ++i) header[8 + i] = uint8_t(kept >> (8 * i));
+		const auto first = (n - kept) & mask;
+		const auto tail = std::min<uint64_t>(kept, mask + 1 - first);
+#ifdef TRACE_POSIX
+		if (lseek(fd, 0, SEEK_SET) < 0) return;
+		if (ftruncate(fd, 0) < 0) return;
+#else
+		_lseek(fd, 0, SEEK_SET);
+		_chsize(fd, 0);
+#endif
+		put(header, sizeof(header));
+		put(ring + first, tail * sizeof(Entry));
+		put(ring, (kept - tail) * sizeof(Entry));
+	}
+
+/**
+ * Read a trace file.
+ * @param aPath Trace file path.
+ * @param aEntries Entries, oldest first.
+ * @return false if the file is invalid.
+ */
+	static bool load(const std::string& aPath, std::vector<Entry>& aEntries) {
+		std::ifstream fs(aPath, std::ios::binary);
+		char header[12];
+		if (!fs.read(header, sizeof(header)) || memcmp(header, "CPMTRC\x01\x00", 8)) {
+			std::cerr << ">> Invalid trace file \"" << aPath << "\"!" << std::endl;
+			return false;
+		}
+		uint32_t n = 0;
+		for (unsigned i = 0; i < 4; ++i) n |= uint32_t(uint8_t(header[8 + i])) << (8 * i);
+		aEntries.resize(n);
+		if (!fs.read(reinterpret_cast<char*>(aEntries.data()), n * sizeof(Entry))) {
+			aEntries.resize(fs.gcount() / sizeof(Entry));
+			std::cerr << ">> Truncated trace file \"" << aPath << "\"!" << std::endl;
+		}
+		return true;
+	}
+
+protected:
+	Trace(const int aFd, const size_t aEntries) :
+		fd(aFd),
+		mask(aEntries - 1),
+		ring(new Entry[aEntries]()) {
+	}
+
+	void put(const void* aData, size_t aLength) const {
+		auto p = static_cast<const char*>(aData);
+		while (aLength) {
+#ifdef TRACE_POSIX
+			const auto w = ::write(fd, p, aLength);
+#else
+			const auto w = ::_write(fd, p, unsigned(aLength));
+#endif
+			if (w <= 0) return;
+			p += w;
+			aLength -= w;
+		}
+	}
+
+	static void onRequest(int) {
+		request() = true;
+	}
+
+	static void onCrash(const int aSignal) {
+		if (active()) active()->dump();
+		const auto h = previous(aSignal);
+		if ((h != SIG_DFL) && (h != SIG_IGN) && (h != SIG_ERR) && (h != onCrash)) {
+			h(aSignal);
+		} else {
+			std::signal(aSignal, SIG_DFL);
+			std::raise(aSignal);
+		}
+	}
+
+private:
+	struct Settings {
+		int fd = -1;
+		size_t entries = DEFAULT_ENTRIES;
+	};
+
+	static Settings& settings() {
+		static Settings s;
+		return s;
+	}
+
+	static Trace*& active() {
+		static Trace* t = NULL;
+		return t;
+	}
+
+	static std::atomic<bool>& request() {
+		static std::atomic<bool> r(false);
+		return r;
+	}
+
+	using Handler = void (*)(int);
+
+	static Handler& previous(const int aSignal) {
+		static Handler handlers[64] = {};
+		return handlers[aSignal & 63];
+	}
+
+	const int fd;
+	const uint64_t mask;
+	Entry *const ring;
+
+/**
+ * Entries recorded since the start (free running).
+ */
+	std::atomic<uint64_t> count { 0 };
+};
@@ -0,0 +1,134 @@
+/**
+ * Copyright 2021 Marc SIBERT
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cctype>
+#include <string>
+#include <atomic>
+#include <ostream>
+
+/**
+ * Write policy of a drive, with the counters showing what it costs.
+ *  * prealloc: host blocks are allocated by extent (16 KB) ahead of the writes;
+ *  * sparse: records skipped by a random write with zero fill (BDOS 40) are
+ *    left as holes instead of being written;
+ *  * sync: files are synchronized to the storage never (default), on close,
+ *    or every N records written.
+ */
+struct WritePolicy {
+	enum class Sync { NEVER, CLOSE, EVERY };
+
+	bool preallocate = false;
+	bool sparse = false;
+	Sync sync = Sync::NEVER;
+	unsigned every = 0;
+
+/**
+ * Counters, shared by all the sessions writing on the drive.
+ */
+	std::atomic<uint64_t> preallocations { 0 };
+	std::atomic<uint64_t> preallocatedBytes { 0 };
+	std::atomic<uint64_t> holes { 0 };
+	std::atomic<uint64_t> zeroed { 0 };
+	std::atomic<uint64_t> syncs { 0 };
+	std::atomic<uint64_t> syncNanoseconds { 0 };
+
+/**
+ * @return true if a host descriptor is needed to apply the policy.
+ */
+	bool needsDescriptor() const {
+		return preallocate || (sync != Sync::NEVER);
+	}
+
+/**
+ * Policy of a drive.
+ * @param aDrive Drive number (0 for A:).
+ */
+	static WritePolicy& drive(const unsigned aDrive) {
+		static WritePolicy policies[16];
+		return policies[aDrive & 0x0F];
+	}
+
+/**
+ * Configure drives policy.
+ * @param aSpec "DRIVES:OPTION[,OPTION...]" with DRIVES as letters (e.g. "BC")
+ *        and OPTION in prealloc, sparse, sync=never, sync=close or sync=N.
+ * @return false if the specification is invalid.
+ */
+	static bool configure(const std::string& aSpec) {
+		const auto colon = aSpec.find(':');
+		if ((colon == std::string::npos) || (colon == 0)) return false;
+		unsigned drives = 0;
+		for (auto i = 0U; i < colon; ++i) {
+			const char d = toupper(aSpec[i]);
+			if ((d < 'A') || (d > 'P')) return false;
+			drives |= 1U << (d - 'A');
+		}
+
+		WritePolicy p;
+		size_t start = colon + 1;
+		while (start <= aSpec.size()) {
+			auto end = aSpec.find(',', start);
+			if (end == std::string::npos) end = aSpec.size();
+			const auto option = aSpec.substr(start, end - start);
+			if (option == "prealloc") {
+				p.preallocate = true;
+			} else if (option == "sparse") {
+				p.sparse = true;
+			} else if (option == "sync=never") {
+				p.sync = Sync::NEVER;
+			} else if (option == "sync=close") {
+				p.sync = Sync::CLOSE;
+			} else if (option.rfind("sync=", 0) == 0) {
+				char* e;
+				const auto n = strtoul(option.c_str() + 5, &e, 10);
+				if (*e || !n) return false;
+				p.sync = Sync::EVERY;
+				p.every = n;
+			} else {
+				return false;
+			}
+			start = end + 1;
+		}
+
+		for (auto d = 0U; d < 16; ++d) {
+			if (!(drives & (1U << d))) continue;
+			auto& w = drive(d);
+			w.preallocate = p.preallocate;
+			w.sparse = p.sparse;
+			w.sync = p.sync;
+			w.every = p.every;
+		}
+		return true;
+	}
+
+/**
+ * Print out the counters of the drives having a policy or some activity.
+ */
+	static void report(std::ostream& aOut) {
+		for (auto d = 0U; d < 16; ++d) {
+			const auto& w = drive(d);
+			if (!w.needsDescriptor() && !w.sparse && !w.holes && !w.zeroed) continue;
+			aOut << char('A' + d) << ": preallocations " << w.preallocations
+				 << " (" << w.preallocatedBytes << " bytes), holes " << w.holes
+				 << " records, zeroed " << w.zeroed << " records, syncs " << w.syncs
+				 << " (" << w.syncNanoseconds / 1000 << " us)" << std::endl;
+		}
+	}
+};